@@ -11,13 +11,134 @@
 #include <linux/interrupt.h>
 #include <linux/poll.h>
 #include <linux/delay.h>
-#include <asm/uaccess.h>
+#include <linux/log2.h>
+#include <linux/moduleparam.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/bitops.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/task.h>
+#endif
+#include <linux/debugfs.h>
+#include <linux/sort.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
 #include "iobus.h"
+#define CREATE_TRACE_POINTS
+#include "iobus_trace.h"
 
 static dev_t devno;
 static struct file_operations fops;
 static struct class *iobus_dev_class;
-static IOBUS_DEV *iobus_dev_glb;
+static const IOBUS_BUS_OPS *iobus_bus_ops;
+static IOBUS_DEV *iobus_devs[IOBUS_MAX_DEVS];
+static unsigned int devices = 1;
+module_param(devices, uint, S_IRUGO);
+MODULE_PARM_DESC(devices, "number of CPLD bus controllers, one /dev/iobusN each (1..4)");
+static unsigned int rx_ring_depth = IOBUS_RX_RING_DEPTH;
+module_param(rx_ring_depth, uint, S_IRUGO);
+MODULE_PARM_DESC(rx_ring_depth, "number of received frames buffered in the driver (rounded up to a power of 2)");
+static unsigned int tx_ring_depth = IOBUS_TX_RING_DEPTH;
+module_param(tx_ring_depth, uint, S_IRUGO);
+MODULE_PARM_DESC(tx_ring_depth, "number of frames queued for transmission (rounded up to a power of 2)");
+static unsigned int frame_max = IOBUS_FRAME_MAX;
+module_param(frame_max, uint, S_IRUGO);
+MODULE_PARM_DESC(frame_max, "maximum frame length in bytes, at most the CPLD DPRAM size (256); sets the ring slot size");
+#ifndef IOBUS_BUS_DEFAULT
+#define IOBUS_BUS_DEFAULT		"gpio"
+#endif
+static char *bus = IOBUS_BUS_DEFAULT;
+module_param(bus, charp, S_IRUGO);
+MODULE_PARM_DESC(bus, "bus backend: gpio (i.MX53 GPIO bit-bang) or sim (simulated CPLD, no hardware)");
+static unsigned int sim_access_ns = 100;
+module_param(sim_access_ns, uint, S_IRUGO);
+MODULE_PARM_DESC(sim_access_ns, "sim: busy-wait per CPLD register/DPRAM access, in ns");
+static unsigned int sim_byte_ns = 4000;
+module_param(sim_byte_ns, uint, S_IRUGO);
+MODULE_PARM_DESC(sim_byte_ns, "sim: line time per transmitted byte, in ns");
+static unsigned int sim_reply_us = 50;
+module_param(sim_reply_us, uint, S_IRUGO);
+MODULE_PARM_DESC(sim_reply_us, "sim: card turnaround from end of transmission to end of reply, in us");
+static bool sim_echo = true;
+module_param(sim_echo, bool, S_IRUGO);
+MODULE_PARM_DESC(sim_echo, "sim: every transmitted frame is answered with a copy of itself");
+
+/**
+ * @brief 随内核版本变化的接口，驱动在2.6.35(目标板)和较新的主机内核(仿真后端)上都能编译
+ */
+static void iobus_hrtimer_init(struct hrtimer *timer, enum hrtimer_restart (*function)(struct hrtimer *))
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(timer, function, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+	hrtimer_init(timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	timer->function = function;
+#endif
+}
+
+static void iobus_set_fifo(struct task_struct *task)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	sched_set_fifo(task);
+#else
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO / 2 };
+	sched_setscheduler(task, SCHED_FIFO, &param);
+#endif
+}
+
+#ifndef ACCESS_ONCE
+#define ACCESS_ONCE(x)		READ_ONCE(x)
+#endif
+
+/**
+ * @brief  统计计数和延迟直方图，每CPU一份，热路径上只做不加锁的本CPU自增
+ */
+#define STAT_INC(dev, field)		this_cpu_inc((dev)->stats->field)
+#define STAT_ADD(dev, field, n)		this_cpu_add((dev)->stats->field, n)
+
+static inline void stat_hist(IOBUS_DEV *iobus_dev, int hist, s64 ns)
+{
+	int bucket = 0;
+	if (ns > 0)
+		bucket = min(fls64(ns), IOBUS_HIST_BUCKETS - 1);
+	this_cpu_inc(iobus_dev->stats->hist[hist][bucket]);
+}
+
+static inline void stat_hist_since(IOBUS_DEV *iobus_dev, int hist, ktime_t start)
+{
+	stat_hist(iobus_dev, hist, ktime_to_ns(ktime_sub(ktime_get(), start)));
+}
+
+/**
+  * @brief  统计计数清零
+  *         各CPU计数在自增的同时可能被清零，清零前后瞬间的个别计数可能丢失
+  */
+static void iobus_stats_reset(IOBUS_DEV *iobus_dev)
+{
+	int cpu = 0;
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(iobus_dev->stats, cpu), 0, sizeof(IOBUS_STATS));
+}
+
+static void iobus_stats_sum(IOBUS_DEV *iobus_dev, IOBUS_STATS *sum)
+{
+	int cpu = 0;
+	int i = 0;
+	unsigned long *dst = (unsigned long *)sum;
+	const unsigned long *src = NULL;
+	memset(sum, 0, sizeof(IOBUS_STATS));
+	for_each_possible_cpu(cpu)
+	{
+		src = (const unsigned long *)per_cpu_ptr(iobus_dev->stats, cpu);
+		for (i=0; i<sizeof(IOBUS_STATS)/sizeof(unsigned long); i++)
+			dst[i] += src[i];
+	}
+}
 
 /**
  * @brief IO脚操作模拟CPLD并行总线时序 
@@ -30,50 +151,61 @@ static IOBUS_DEV *iobus_dev_glb;
  *		  set_addr		 设置地址总线为给定地址值
  *        write_data	 向总线写入数据
  *		  read_data		 从总线读出数据
+ *        除read_data外均只写寄存器，输出值取自IOBUS_DEV中的影子寄存器，掩码和移位取自本实例的管脚表，
+ *        影子值在gpio_init()中读取一次，此后只由软件维护，调用者需持有bus_lock
+ *        以下gpio_*系列为GPIO模拟总线后端的实现，驱动其余部分通过write_cpld等经bus_ops访问CPLD
  */
 inline void set_wr(IOBUS_DEV *iobus_dev) 
 {
-	iowrite32(ioread32(iobus_dev->gpio1_regs + GPIO1_DR) & 0xFFFFFFFE, iobus_dev->gpio1_regs + GPIO1_DR);
+	iobus_dev->ctl_dr &= ~iobus_dev->bus_wr;
+	iowrite32(iobus_dev->ctl_dr, iobus_dev->ctl_regs + GPIO_DR);
 }
 
 inline void clr_wr(IOBUS_DEV *iobus_dev) 
 {
-	iowrite32(ioread32(iobus_dev->gpio1_regs + GPIO1_DR) | 0x1, iobus_dev->gpio1_regs + GPIO1_DR);
+	iobus_dev->ctl_dr |= iobus_dev->bus_wr;
+	iowrite32(iobus_dev->ctl_dr, iobus_dev->ctl_regs + GPIO_DR);
 }
 
 inline void set_rd(IOBUS_DEV *iobus_dev)
 {
-	iowrite32(ioread32(iobus_dev->gpio1_regs + GPIO1_DR) & 0xFFFFFFFD, iobus_dev->gpio1_regs + GPIO1_DR);
+	iobus_dev->ctl_dr &= ~iobus_dev->bus_rd;
+	iowrite32(iobus_dev->ctl_dr, iobus_dev->ctl_regs + GPIO_DR);
 }
 
 inline void clr_rd(IOBUS_DEV *iobus_dev)
 {
-	iowrite32(ioread32(iobus_dev->gpio1_regs + GPIO1_DR) | 0x2, iobus_dev->gpio1_regs + GPIO1_DR);
+	iobus_dev->ctl_dr |= iobus_dev->bus_rd;
+	iowrite32(iobus_dev->ctl_dr, iobus_dev->ctl_regs + GPIO_DR);
 }
 
 inline void set_data_in(IOBUS_DEV *iobus_dev)
 {
-	iowrite32(ioread32(iobus_dev->gpio3_regs + GPIO3_GDIR) & 0xFF00FFFF, iobus_dev->gpio3_regs + GPIO3_GDIR);
+	iobus_dev->data_gdir &= ~iobus_dev->data_msk;
+	iowrite32(iobus_dev->data_gdir, iobus_dev->data_regs + GPIO_GDIR);
 }
 
 inline void set_data_out(IOBUS_DEV *iobus_dev)
 {
-	iowrite32(ioread32(iobus_dev->gpio3_regs + GPIO3_GDIR) | 0xFF0000, iobus_dev->gpio3_regs + GPIO3_GDIR);
+	iobus_dev->data_gdir |= iobus_dev->data_msk;
+	iowrite32(iobus_dev->data_gdir, iobus_dev->data_regs + GPIO_GDIR);
 }
 
 inline void set_addr(IOBUS_DEV *iobus_dev, int addr)
 {
-	iowrite32((ioread32(iobus_dev->gpio4_regs + GPIO4_DR) & GPIO4_ADDR_MSK) | (addr << CPLD_ADDR_SHIFT), iobus_dev->gpio4_regs + GPIO4_DR);
+	iobus_dev->addr_dr = (iobus_dev->addr_dr & ~iobus_dev->addr_msk) | ((addr << iobus_dev->addr_shift) & iobus_dev->addr_msk);
+	iowrite32(iobus_dev->addr_dr, iobus_dev->addr_regs + GPIO_DR);
 }
 
 inline void write_data(IOBUS_DEV *iobus_dev, unsigned char data)
 {
-	iowrite32((ioread32(iobus_dev->gpio3_regs + GPIO3_DR) & GPIO3_DATA_MSK) | (data << CPLD_DATA_SHIFT), iobus_dev->gpio3_regs + GPIO3_DR);
+	iobus_dev->data_dr = (iobus_dev->data_dr & ~iobus_dev->data_msk) | (data << iobus_dev->data_shift);
+	iowrite32(iobus_dev->data_dr, iobus_dev->data_regs + GPIO_DR);
 }
 
 inline unsigned char read_data(IOBUS_DEV *iobus_dev)
 {
-	return (unsigned char)((ioread32(iobus_dev->gpio3_regs + GPIO3_DR) & (~GPIO3_DATA_MSK)) >> CPLD_DATA_SHIFT);
+	return (unsigned char)((ioread32(iobus_dev->data_regs + GPIO_DR) & iobus_dev->data_msk) >> iobus_dev->data_shift);
 }
 /** 
   * @brief  写CPLD寄存器或者双口RAM
@@ -82,7 +214,7 @@ inline unsigned char read_data(IOBUS_DEV *iobus_dev)
   *		    data 要写入的数据 
   * @retval 无
   */
-inline void write_cpld(IOBUS_DEV *iobus_dev, int addr, unsigned char data)
+inline void gpio_write_cpld(IOBUS_DEV *iobus_dev, int addr, unsigned char data)
 {
 	set_data_out(iobus_dev);
 	set_addr(iobus_dev, addr);
@@ -97,7 +229,7 @@ inline void write_cpld(IOBUS_DEV *iobus_dev, int addr, unsigned char data)
   *		    addr CPLD寄存器或者双口RAM地址
   * @retval 读出的数据 
   */
-inline unsigned char read_cpld(IOBUS_DEV *iobus_dev, int addr)
+inline unsigned char gpio_read_cpld(IOBUS_DEV *iobus_dev, int addr)
 {
 	set_data_in(iobus_dev);
 	set_addr(iobus_dev, addr);
@@ -106,47 +238,276 @@ inline unsigned char read_cpld(IOBUS_DEV *iobus_dev, int addr)
 	return read_data(iobus_dev);
 }
 
+/** 
+  * @brief  连续写CPLD双口RAM
+  *         数据总线方向只设置一次，循环内只更新地址、数据并产生写脉冲
+  * @param  iobus_dev 自定义iobus封装设备
+  *		    addr 起始地址
+  *		    buf 要写入的数据
+  *		    len 数据长度
+  * @retval 无
+  */
+inline void gpio_write_cpld_burst(IOBUS_DEV *iobus_dev, int addr, const unsigned char *buf, int len)
+{
+	int i = 0;
+	set_data_out(iobus_dev);
+	for (i=0; i<len; i++)
+	{
+		set_addr(iobus_dev, addr + i);
+		write_data(iobus_dev, buf[i]);
+		set_wr(iobus_dev);
+		clr_wr(iobus_dev);
+	}
+	set_data_in(iobus_dev);
+}
+/** 
+  * @brief  连续读CPLD双口RAM
+  *         数据总线方向只设置一次，循环内只更新地址并产生读脉冲
+  * @param  iobus_dev 自定义iobus封装设备
+  *		    addr 起始地址
+  *		    buf 读出数据存放的缓存
+  *		    len 数据长度
+  * @retval 无
+  */
+inline void gpio_read_cpld_burst(IOBUS_DEV *iobus_dev, int addr, unsigned char *buf, int len)
+{
+	int i = 0;
+	set_data_in(iobus_dev);
+	for (i=0; i<len; i++)
+	{
+		set_addr(iobus_dev, addr + i);
+		set_rd(iobus_dev);
+		clr_rd(iobus_dev);
+		buf[i] = read_data(iobus_dev);
+	}
+}
+
+/**
+  * @brief  CPLD访问接口，经bus_ops分派到GPIO模拟总线或仿真CPLD
+  *         每次访问只在总线周期内持bus_lock，可在持有或不持有spinlock时调用
+  *         访问控制寄存器的调用者仍需持有spinlock以保护寄存器镜像；
+  *         双口RAM的整块访问不持spinlock，与中断顶半部和另一方向的收发交错使用总线
+  */
+inline void write_cpld(IOBUS_DEV *iobus_dev, int addr, unsigned char data)
+{
+	unsigned long flags = 0;
+	spin_lock_irqsave(&iobus_dev->bus_lock, flags);
+	iobus_dev->bus_ops->write(iobus_dev, addr, data);
+	spin_unlock_irqrestore(&iobus_dev->bus_lock, flags);
+}
+
+inline unsigned char read_cpld(IOBUS_DEV *iobus_dev, int addr)
+{
+	unsigned long flags = 0;
+	unsigned char data = 0;
+	spin_lock_irqsave(&iobus_dev->bus_lock, flags);
+	data = iobus_dev->bus_ops->read(iobus_dev, addr);
+	spin_unlock_irqrestore(&iobus_dev->bus_lock, flags);
+	return data;
+}
+
+inline void write_cpld_burst(IOBUS_DEV *iobus_dev, int addr, const unsigned char *buf, int len)
+{
+	unsigned long flags = 0;
+	spin_lock_irqsave(&iobus_dev->bus_lock, flags);
+	iobus_dev->bus_ops->write_burst(iobus_dev, addr, buf, len);
+	spin_unlock_irqrestore(&iobus_dev->bus_lock, flags);
+}
+
+inline void read_cpld_burst(IOBUS_DEV *iobus_dev, int addr, unsigned char *buf, int len)
+{
+	unsigned long flags = 0;
+	spin_lock_irqsave(&iobus_dev->bus_lock, flags);
+	iobus_dev->bus_ops->read_burst(iobus_dev, addr, buf, len);
+	spin_unlock_irqrestore(&iobus_dev->bus_lock, flags);
+}
+
+/**
+  * @brief  驱动自己维护的CPLD控制寄存器镜像，调用者需持有spinlock
+  *         write_ctrl   写寄存器并更新镜像
+  *         update_ctrl  与镜像相同时不写，用于每帧都要写但多数时候不变的寄存器
+  *         ctrl_reg     读镜像，代替一次总线读周期
+  *         RTER不在镜像中维护，见modify_rter
+  */
+inline void write_ctrl(IOBUS_DEV *iobus_dev, int addr, unsigned char data)
+{
+	iobus_dev->ctrl_mirror[addr - CPLD_CTRL_BASE] = data;
+	write_cpld(iobus_dev, addr, data);
+}
+
+inline void update_ctrl(IOBUS_DEV *iobus_dev, int addr, unsigned char data)
+{
+	if (iobus_dev->ctrl_mirror[addr - CPLD_CTRL_BASE] != data)
+		write_ctrl(iobus_dev, addr, data);
+}
+
+inline unsigned char ctrl_reg(IOBUS_DEV *iobus_dev, int addr)
+{
+	return iobus_dev->ctrl_mirror[addr - CPLD_CTRL_BASE];
+}
+
+/**
+  * @brief  RTER置位/清位，调用者需持有spinlock
+  *         HSND_EN/HREC_EN在发送/接收完成时被CPLD自动清零，镜像要到锁存TMC/RMC后才知道，
+  *         期间按镜像写回会在接收双口RAM读出之前重新使能接收；因此每次从硬件读回再写，
+  *         读和写在同一次bus_lock内完成
+  */
+inline void modify_rter(IOBUS_DEV *iobus_dev, unsigned char set, unsigned char clr)
+{
+	unsigned long flags = 0;
+	unsigned char data = 0;
+	spin_lock_irqsave(&iobus_dev->bus_lock, flags);
+	data = iobus_dev->bus_ops->read(iobus_dev, RTER);
+	iobus_dev->bus_ops->write(iobus_dev, RTER, (data & ~clr) | set);
+	spin_unlock_irqrestore(&iobus_dev->bus_lock, flags);
+}
+
+/**
+  * @brief 收发队列共享区
+  *        首页为IOBUS_SHM_HDR，其后依次为接收帧数组和发送帧数组，整体可mmap到用户态
+  *        队列深度向上取整为2的幂，每帧按frame_max和缓存行对齐占用IOBUS_FRAME_STRIDE字节
+  *        模块加载时一次分配，收发路径上不再分配内存
+  */
+int shm_init(IOBUS_DEV *iobus_dev, unsigned int rx_depth, unsigned int tx_depth)
+{
+	unsigned int rx_off = 0;
+	unsigned int tx_off = 0;
+	unsigned int size = 0;
+	unsigned int stride = IOBUS_FRAME_STRIDE(iobus_dev->frame_max);
+	IOBUS_SHM_HDR *hdr = NULL;
+	rx_depth = roundup_pow_of_two(rx_depth ? rx_depth : 1);
+	tx_depth = roundup_pow_of_two(tx_depth ? tx_depth : 1);
+	rx_off = PAGE_ALIGN(sizeof(IOBUS_SHM_HDR));
+	tx_off = rx_off + rx_depth * stride;
+	size = PAGE_ALIGN(tx_off + tx_depth * stride);
+	/* vmalloc_user分配的内存已清零，且可用remap_vmalloc_range映射 */
+	iobus_dev->shm = vmalloc_user(size);
+	if (iobus_dev->shm == NULL)
+		return -ENOMEM;
+	hdr = (IOBUS_SHM_HDR *)iobus_dev->shm;
+	hdr->size = size;
+	hdr->frame_max = iobus_dev->frame_max;
+	ring_init(&iobus_dev->rx_ring, &hdr->rx, iobus_dev->shm, rx_off, rx_depth, stride);
+	ring_init(&iobus_dev->tx_ring, &hdr->tx, iobus_dev->shm, tx_off, tx_depth, stride);
+	atomic_set(&iobus_dev->mmap_count, 0);
+	return 0;
+}
+
+/**
+  * @brief  在共享区首页发布最近一次发送完成的时间，调用者需持有spinlock
+  *         更新前后各把tx_done_seq加1，用户态读取方式与扫描结果表项相同
+  */
+static void shm_tx_done(IOBUS_DEV *iobus_dev, s64 tstamp)
+{
+	IOBUS_SHM_HDR *hdr = (IOBUS_SHM_HDR *)iobus_dev->shm;
+	hdr->tx_done_seq++;
+	smp_wmb();
+	hdr->tx_done_count++;
+	hdr->tx_done_tstamp = tstamp;
+	smp_wmb();
+	hdr->tx_done_seq++;
+}
+
+void shm_free(IOBUS_DEV *iobus_dev)
+{
+	vfree(iobus_dev->shm);
+	iobus_dev->shm = NULL;
+}
+
+/**
+  * @brief 帧环形队列
+  *        ring_init			 在共享区中建立队列
+  *        ring_push_slot		 生产者取得下一个空闲帧，队列满时返回NULL
+  *        ring_push			 生产者填好帧后提交
+  *        ring_pop_slot		 消费者取得最早的一帧，队列空时返回NULL
+  *        ring_pop				 消费者用完帧后释放
+  *        生产者与消费者各自只修改head或tail，单生产者单消费者时无需加锁
+  *        mmap后head/tail可能被用户态改写，下标总是与mask相与，不会越界
+  */
+void ring_init(IOBUS_RING *ring, IOBUS_RING_CTL *ctl, void *base, unsigned int offset, unsigned int depth, unsigned int stride)
+{
+	ring->ctl = ctl;
+	ring->mask = depth - 1;
+	ring->stride = stride;
+	ring->frames = (unsigned char *)base + offset;
+	ctl->depth = depth;
+	ctl->offset = offset;
+	ctl->stride = stride;
+	ring_reset(ring);
+}
+
+void ring_reset(IOBUS_RING *ring)
+{
+	ring->ctl->head = 0;
+	ring->ctl->tail = 0;
+	ring->ctl->idle = 1;
+}
+
+inline bool ring_empty(IOBUS_RING *ring)
+{
+	return ACCESS_ONCE(ring->ctl->head) == ACCESS_ONCE(ring->ctl->tail);
+}
+
+inline bool ring_full(IOBUS_RING *ring)
+{
+	return ACCESS_ONCE(ring->ctl->head) - ACCESS_ONCE(ring->ctl->tail) > ring->mask;
+}
+
+inline IOBUS_FRAME *ring_push_slot(IOBUS_RING *ring)
+{
+	if (ring_full(ring))
+		return NULL;
+	return (IOBUS_FRAME *)(ring->frames + (ring->ctl->head & ring->mask) * ring->stride);
+}
+
+inline void ring_push(IOBUS_RING *ring)
+{
+	/* 帧内容对消费者可见后再移动head */
+	smp_wmb();
+	ring->ctl->head++;
+}
+
+inline IOBUS_FRAME *ring_pop_slot(IOBUS_RING *ring)
+{
+	if (ring_empty(ring))
+		return NULL;
+	/* 先看到head再读取帧内容 */
+	smp_rmb();
+	return (IOBUS_FRAME *)(ring->frames + (ring->ctl->tail & ring->mask) * ring->stride);
+}
+
+inline void ring_pop(IOBUS_RING *ring)
+{
+	/* 帧内容读取完毕后再把空间还给生产者 */
+	smp_mb();
+	ring->ctl->tail++;
+}
+
 /** 
   * @brief GPIO配置 
-  * 利用GPIO口模拟ARM和CPLD之间通信的并行总线
-  * gpio4-6 ~ gpio4-15 对应地址线 A0 ~ A9
-  * gpio3-16 ~ gpio3-23 对应数据线 D0 ~ D7
-  * gpio1-0 对应读信号 nOE
-  * gpio1-1 对应写信号 nWR
-  * gpio7-7 对应HDLC中断信号 INT
+  * 利用GPIO口模拟ARM和CPLD之间通信的并行总线，管脚分配见iobus_board.h
+  * 地址线、数据线、读写信号(低有效)和HDLC中断信号(上升沿)各自所在的GPIO组与管脚由本实例的管脚表给出
   */
 void gpio_init(IOBUS_DEV *iobus_dev) 
 {
-/* 配置并行总线地址gpio4_6~gpio4_15对应IO的复用模式并设置地址IO为输出 */
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO4_6);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO4_7);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO4_8);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO4_9);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO4_10);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO4_11);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO4_12);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO4_13);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO4_14);
-	iowrite32(GPIO4_DIR_ADDR_OUT | ioread32(iobus_dev->gpio4_regs + GPIO4_GDIR), iobus_dev->gpio4_regs + GPIO4_GDIR);
-/* 配置并行总线数据gpio3_16~gpio3_23的IO复用模式 */
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO3_16);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO3_17);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO3_18);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO3_19);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO3_20);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO3_21);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO3_22);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO3_23);
-/* 配置控制并行总线读写管脚gpio1_0(WR) gpio1_1(RD)的IO复用模式并设置为输出 */
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO1_0);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO1_1);	
-	iowrite32(GPIO1_DIR_RDWR_OUT | ioread32(iobus_dev->gpio1_regs + GPIO1_GDIR), iobus_dev->gpio1_regs + GPIO1_GDIR);
-/* 配置gpio4_15为中断引脚, 上升沿 */
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO4_15);
-	iowrite32(GPIO4_ICR15_RISING | ioread32(iobus_dev->gpio4_regs + GPIO4_ICR1), iobus_dev->gpio4_regs + GPIO4_ICR1);
-	iowrite32(GPIO4_IMR15_ENABLE | ioread32(iobus_dev->gpio4_regs + GPIO4_IMR), iobus_dev->gpio4_regs + GPIO4_IMR);
-	iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + IOMUX_SW_CTRL_GPIO1_8);
-	iowrite32(0x100 | ioread32(iobus_dev->gpio1_regs + GPIO1_GDIR), iobus_dev->gpio1_regs + GPIO1_GDIR);
+	const IOBUS_BOARD_BUS *board = iobus_dev->board;
+	unsigned int i = 0;
+/* 配置本控制器全部总线管脚的IO复用模式为GPIO */
+	for (i=0; i<ARRAY_SIZE(board->iomux_pads); i++)
+		iowrite32(IOMUX_MOD_GPIO, iobus_dev->iomux_regs + board->iomux_pads[i]);
+/* 地址线和读写信号为输出，数据线方向在每次访问时设置 */
+	iowrite32(iobus_dev->addr_msk | ioread32(iobus_dev->addr_regs + GPIO_GDIR), iobus_dev->addr_regs + GPIO_GDIR);
+	iowrite32(iobus_dev->bus_wr | iobus_dev->bus_rd | ioread32(iobus_dev->ctl_regs + GPIO_GDIR), iobus_dev->ctl_regs + GPIO_GDIR);
+/* 配置中断管脚为上升沿触发 */
+	iowrite32(GPIO_ICR_RISING(board->irq_pin) | ioread32(iobus_dev->irq_regs + GPIO_ICR(board->irq_pin)),
+		iobus_dev->irq_regs + GPIO_ICR(board->irq_pin));
+	iowrite32((1U << board->irq_pin) | ioread32(iobus_dev->irq_regs + GPIO_IMR), iobus_dev->irq_regs + GPIO_IMR);
+/* 读取一次数据/方向寄存器作为影子值，此后总线操作不再回读
+   注意：这几组GPIO上其余管脚若被其他驱动改写，会被影子值覆盖 */
+	iobus_dev->ctl_dr = ioread32(iobus_dev->ctl_regs + GPIO_DR);
+	iobus_dev->data_dr = ioread32(iobus_dev->data_regs + GPIO_DR);
+	iobus_dev->data_gdir = ioread32(iobus_dev->data_regs + GPIO_GDIR);
+	iobus_dev->addr_dr = ioread32(iobus_dev->addr_regs + GPIO_DR);
 /* 设置读写信号无效状态 */
 	clr_wr(iobus_dev);
 	clr_rd(iobus_dev);	
@@ -162,354 +523,2851 @@ void gpio_init(IOBUS_DEV *iobus_dev)
 void hdlc_init(IOBUS_DEV *iobus_dev)
 {
 	iobus_dev->send_stat = IDLE;			//发送空闲态，硬件发送未被占用
-	iobus_dev->recv_stat = BUSY;			//接收繁忙态，无数据返回
+	iobus_dev->tx_staged = false;
+	iobus_dev->tx_filling = false;
+	ring_reset(&iobus_dev->rx_ring);		//只在模块加载时调用一次，收发队列从空开始
+	ring_reset(&iobus_dev->tx_ring);
+	iobus_dev->xact_state = XACT_IDLE;
+	iobus_dev->reply_owner = REPLY_NONE;
+	iobus_dev->rx_draining = false;
 	spin_lock_irq(&iobus_dev->spinlock);	//上锁 
-	write_cpld(iobus_dev, TCR, ITF_1);		
-	write_cpld(iobus_dev, RPAMR1, 0x7F);
-	write_cpld(iobus_dev, IMR, RMC_EN | TMC_EN);
-	write_cpld(iobus_dev, RUNSTAT, RUNSTAT_S);
-	write_cpld(iobus_dev, CHSEL, CH2SEL);
-	write_cpld(iobus_dev, RXTXEN, RXTXEN_R);
+	/* 控制寄存器镜像：寄存器在此全部写一遍，RTER不做镜像 */
+	memset(iobus_dev->ctrl_mirror, 0, sizeof(iobus_dev->ctrl_mirror));
+	write_ctrl(iobus_dev, TCR, ITF_1);		
+	write_ctrl(iobus_dev, RPAMR1, 0x7F);
+	write_ctrl(iobus_dev, RPAR, 0);
+	write_ctrl(iobus_dev, TNUMR_L, 0);
+	write_ctrl(iobus_dev, TNUMR_H, 0);
+	write_ctrl(iobus_dev, IMR, RMC_EN | TMC_EN);
+	write_ctrl(iobus_dev, RUNSTAT, RUNSTAT_S);
+	write_ctrl(iobus_dev, CHSEL, CH2SEL);
+	write_ctrl(iobus_dev, RXTXEN, RXTXEN_R);
 	spin_unlock_irq(&iobus_dev->spinlock);	//解锁
 }
 
 
-static irqreturn_t hdlc_interrupt_handler(int irq, void *dev_id)
+/**
+  * @brief  选中一帧待发送：拷入tx_stage并占用发送双口RAM，调用者需持有spinlock
+  *         只做内存拷贝，双口RAM的写入和启动发送由调用者解锁后经hdlc_tx_fill完成
+  */
+static void hdlc_stage_frame(IOBUS_DEV *iobus_dev, const IOBUS_FRAME *frame, unsigned short len)
 {
-	IOBUS_DEV *iobus_dev = NULL;
-	unsigned char isr = 0;
-	unsigned char rsr = 0;
-	unsigned int addr = 0;
-	if (irq != gpio_to_irq(GPIO4_15))	
+	IOBUS_FRAME *stage = &iobus_dev->tx_stage;
+	stage->len = len;
+	stage->addr = frame->addr;
+	stage->chan = frame->chan;
+	stage->flags = frame->flags;
+	stage->tstamp = frame->tstamp;
+	memcpy(stage->data, frame->data, len);
+	iobus_dev->tx_staged = true;
+	iobus_dev->tx_stage_owner = REPLY_NONE;
+	/* 设置发送状态为繁忙，发送完成中断到来前不再选择下一帧 */
+	iobus_dev->send_stat = BUSY;
+	iobus_dev->tx_enqueue_ns = frame->tstamp;
+	iobus_dev->tx_len = len;
+}
+
+/**
+  * @brief  tx_stage已写入发送双口RAM后设置寄存器并启动发送，调用者需持有spinlock
+  *         需要返回的帧从此刻开始计算等待超时
+  */
+static void hdlc_tx_launch(IOBUS_DEV *iobus_dev)
+{
+	const IOBUS_FRAME *frame = &iobus_dev->tx_stage;
+	if (frame->chan != IOBUS_CHAN_KEEP)
+		update_ctrl(iobus_dev, CHSEL, frame->chan);
+	trace_iobus_tx_fill(frame->addr, ctrl_reg(iobus_dev, CHSEL), frame->len);
+	/* 卡件地址写到RPAR寄存器中, 等待卡件返回数据，与上一帧相同时不再写 */
+	if (!(frame->flags & IOBUS_TXF_KEEP_RPAR))
+		update_ctrl(iobus_dev, RPAR, frame->addr);
+	write_ctrl(iobus_dev, TNUMR_L, (unsigned char)(frame->len & 0xFF));
+	update_ctrl(iobus_dev, TNUMR_H, (unsigned char)((frame->len >> 8) & 0xFF));
+	/* 使能RS485发送，使能CPLD寄存器发送 */
+	write_ctrl(iobus_dev, RXTXEN, RXTXEN_T);
+	modify_rter(iobus_dev, HSND_EN, 0);
+	trace_iobus_tx_start(frame->len);
+	iobus_dev->tx_start = ktime_get();
+	if (iobus_dev->tx_stage_owner != REPLY_NONE)
 	{
-		printk(KERN_ERR "irq number dosen't matched!\n");
-		return IRQ_NONE;
+		iobus_dev->armed_seq = iobus_dev->tx_stage_seq;
+		hrtimer_start(&iobus_dev->reply_timer, iobus_dev->reply_timeout, HRTIMER_MODE_REL);
 	}
-	iobus_dev = (IOBUS_DEV *)dev_id;
-	iowrite32(0x100 | ioread32(iobus_dev->gpio1_regs + GPIO1_DR), iobus_dev->gpio1_regs + GPIO1_DR);
-	iowrite32(0xfffffeff & ioread32(iobus_dev->gpio1_regs + GPIO1_DR), iobus_dev->gpio1_regs + GPIO1_DR);
-	/* 判断GPIO ISR 并且清除相应中断标志 */
-/* 总是读不到正确的值所以去掉该段代码
-	isr_gpio = ioread32(iobus_dev->gpio4_regs + GPIO4_ISR);
-	printk(KERN_ERR "%x\n", isr_gpio);
-	if (!(isr_gpio & 0x8000))
-	{	
-		printk(KERN_ERR "here\n");
-		return IRQ_NONE;
-	}*/
-//	iowrite32(ioread32(iobus_dev->gpio4_regs + GPIO4_ISR) & 0x00008000, iobus_dev->gpio4_regs + GPIO4_ISR);
-	/* 接收完成，判断寄存器，设置标志，调度task完成cpld缓存的读取 */
+}
+
+/**
+  * @brief  把hdlc_start_tx选中的帧写入发送双口RAM并启动发送，调用者不能持有spinlock
+  *         双口RAM每次只写IOBUS_DRAIN_CHUNK字节，期间只持bus_lock，
+  *         中断顶半部和接收双口RAM的读取可在块之间访问总线
+  *         已有线程在写入时直接返回，由该线程启动发送；写入期间等待被取消的帧不再发出，改选下一帧
+  *         凡在持锁期间调用过hdlc_start_tx的路径，解锁后都需调用本函数
+  */
+static void hdlc_tx_fill(IOBUS_DEV *iobus_dev)
+{
+	int addr = 0;
+	int len = 0;
+	IOBUS_FRAME *frame = &iobus_dev->tx_stage;
 	spin_lock_irq(&iobus_dev->spinlock);
-	isr = read_cpld(iobus_dev, ISR);
-	if (isr & RMC)
+	while (iobus_dev->tx_staged && !iobus_dev->tx_filling)
 	{
-		rsr = read_cpld(iobus_dev, RSR);
-		if (rsr == 0)
+		iobus_dev->tx_filling = true;
+		spin_unlock_irq(&iobus_dev->spinlock);
+		/* 帧数据写入CPLD发送双口RAM，tx_filling置位期间tx_stage不会被改写 */
+		for (addr=0; addr<frame->len; addr+=len)
 		{
-/*
-			iobus_dev->recv_bytes = (read_cpld(iobus_dev, RDN1) | (read_cpld(iobus_dev, RDN2) << 8)) & 0xFFFF;
-			for (addr=0; addr<iobus_dev->recv_bytes; addr++)
-			{
-				iobus_dev->recv_buf[addr] = read_cpld(iobus_dev, addr);
-			}
-			write_cpld(iobus_dev, RTER, read_cpld(iobus_dev, RTER) | HREC_EN);*/
-			iobus_dev->recv_bytes = (read_cpld(iobus_dev, RDN1) | (read_cpld(iobus_dev, RDN2) << 8)) & 0xFFFF;
-	/*  从CPLD接收双口RAM中读取数据到内核缓存 */
-			for (addr=0; addr<iobus_dev->recv_bytes; addr++)
-			{
-				iobus_dev->recv_buf[addr] = read_cpld(iobus_dev, addr);
-			}
-	/*  因为接收完成后接收使能自动清零，需手动使能接收 */
-			write_cpld(iobus_dev, RTER, read_cpld(iobus_dev, RTER) | HREC_EN);
-			iobus_dev->recv_stat = IDLE;
-			wake_up_interruptible(&iobus_dev->recv_wq);
-			//tasklet_schedule(&iobus_dev->recv_tasklet);
-			spin_unlock_irq(&iobus_dev->spinlock);
-			return IRQ_HANDLED;
+			len = min(frame->len - addr, IOBUS_DRAIN_CHUNK);
+			write_cpld_burst(iobus_dev, addr, frame->data + addr, len);
 		}
+		spin_lock_irq(&iobus_dev->spinlock);
+		iobus_dev->tx_filling = false;
+		iobus_dev->tx_staged = false;
+		if (iobus_dev->tx_stage_owner != REPLY_NONE &&
+			(iobus_dev->reply_owner != iobus_dev->tx_stage_owner || iobus_dev->reply_seq != iobus_dev->tx_stage_seq))
+		{
+			iobus_dev->send_stat = IDLE;
+			hdlc_start_tx(iobus_dev);
+			continue;
+		}
+		hdlc_tx_launch(iobus_dev);
 	}
-/* 发送完成，判断寄存器，设置RS485为接收，设置标志，唤醒阻塞进程 */
-	if (isr & TMC)
-	{
-		write_cpld(iobus_dev, RXTXEN, RXTXEN_R);
-		write_cpld(iobus_dev, RTER, read_cpld(iobus_dev, RTER) | HREC_EN);
-		iobus_dev->send_stat = IDLE;
-		wake_up_interruptible(&iobus_dev->send_wq);
-		spin_unlock_irq(&iobus_dev->spinlock);
-		return IRQ_HANDLED;
-	}
-	return IRQ_NONE;
+	spin_unlock_irq(&iobus_dev->spinlock);
 }
-/* 接收中断底半部 */
 
-void recv_tasklet_func(unsigned long data) 
+/**
+  * @brief  取发送队列中下一个合法帧，队列空时返回NULL，调用者需持有spinlock
+  *         mmap用户态写入的帧长度不可信，非法帧直接丢弃
+  */
+static IOBUS_FRAME *tx_ring_next(IOBUS_DEV *iobus_dev, unsigned short *len)
 {
-	int addr = 0;
-	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)data;
-	spin_lock_irq(&iobus_dev->spinlock);
-	iobus_dev->recv_bytes = (read_cpld(iobus_dev, RDN1) | (read_cpld(iobus_dev, RDN2) << 8)) & 0xFFFF;
-	/*  从CPLD接收双口RAM中读取数据到内核缓存 */
-	for (addr=0; addr<iobus_dev->recv_bytes; addr++)
+	IOBUS_FRAME *frame = NULL;
+	for (;;)
 	{
-		iobus_dev->recv_buf[addr] = read_cpld(iobus_dev, addr);
+		frame = ring_pop_slot(&iobus_dev->tx_ring);
+		if (frame == NULL)
+		{
+			/* 先置空闲标志再复查队列，与mmap用户态入队后检查idle配对，避免漏发 */
+			iobus_dev->tx_ring.ctl->idle = 1;
+			smp_mb();
+			if (ring_empty(&iobus_dev->tx_ring))
+				return NULL;
+			continue;
+		}
+		iobus_dev->tx_ring.ctl->idle = 0;
+		*len = ACCESS_ONCE(frame->len);
+		if (*len != 0 && *len <= iobus_dev->frame_max)
+			return frame;
+		STAT_INC(iobus_dev, tx_invalid);
+		ring_pop(&iobus_dev->tx_ring);
 	}
-	iobus_dev->recv_stat = IDLE;
-	/*  因为接收完成后接收使能自动清零，需手动使能接收 */
-	write_cpld(iobus_dev, RTER, read_cpld(iobus_dev, RTER) | HREC_EN);
-	spin_unlock_irq(&iobus_dev->spinlock);
 }
-/** @brief 设备文件操作打开函数
+
+/**
+  * @brief  开始等待返回，调用者需持有spinlock
+  *         超时定时器在hdlc_tx_launch启动发送时才开始计时
   */
-static int iobus_open(struct inode *inode, struct file *filp)
+static void reply_wait_start(IOBUS_DEV *iobus_dev, int owner, ktime_t timeout)
 {
-	IOBUS_DEV *iobus_dev = NULL;
-	/* 检查设备号是否对应iobus设备 */
-	if (inode->i_cdev->dev != devno)
+	iobus_dev->reply_owner = owner;
+	iobus_dev->reply_seq++;
+	iobus_dev->reply_timeout = timeout;
+	iobus_dev->tx_stage_owner = owner;
+	iobus_dev->tx_stage_seq = iobus_dev->reply_seq;
+}
+
+/**
+  * @brief  发送一帧需要返回的命令并开始等待，冗余模式下按首发或重发选择通道
+  */
+static void reply_send(IOBUS_DEV *iobus_dev, IOBUS_FRAME *frame, int owner, ktime_t timeout)
+{
+	if (iobus_dev->red_enable)
+		frame->chan = iobus_dev->red_chan[iobus_dev->red_retry];
+	hdlc_stage_frame(iobus_dev, frame, frame->len);
+	reply_wait_start(iobus_dev, owner, timeout);
+}
+
+/**
+  * @brief  重发当前等待返回的命令，通道由reply_send按冗余状态选择，调用者需持有spinlock
+  */
+static void reply_resend(IOBUS_DEV *iobus_dev)
+{
+	int owner = iobus_dev->reply_owner;
+	iobus_dev->reply_owner = REPLY_NONE;
+	if (owner == REPLY_XACT)
+		reply_send(iobus_dev, &iobus_dev->xact_tx, owner, iobus_dev->reply_timeout);
+	else
+		reply_send(iobus_dev, &iobus_dev->scan_tx, owner, iobus_dev->reply_timeout);
+}
+
+/**
+  * @brief  等待返回超时，冗余模式下首次超时在另一通道重发，调用者需持有spinlock
+  * @retval 已重发返回true，否则返回false，由调用者按超时完成
+  */
+static bool reply_retry(IOBUS_DEV *iobus_dev)
+{
+	if (!iobus_dev->red_enable || iobus_dev->red_retry)
+		return false;
+	STAT_INC(iobus_dev, red_retries);
+	iobus_dev->red_retry = true;
+	reply_resend(iobus_dev);
+	return true;
+}
+
+/**
+  * @brief  硬件发送空闲时选择下一帧发送，调用者需持有spinlock
+  *         等待卡件返回期间不发送其他帧，避免与卡件返回冲突
+  *         优先级：周期广播 > 事务帧 > 扫描表中的下一项 > 发送队列
+  *         由iobus_write入队后、中断线程收到TMC/RMC后及扫描线程调用，实现帧的连续发送
+  *         选中的帧只拷入tx_stage，调用者解锁后需调用hdlc_tx_fill写入双口RAM并启动发送
+  */
+void hdlc_start_tx(IOBUS_DEV *iobus_dev)
+{
+	unsigned int i = 0;
+	IOBUS_FRAME *frame = NULL;
+	IOBUS_SCAN_ENTRY *entry = NULL;
+	unsigned short len = 0;
+	if (iobus_dev->send_stat == BUSY)
+		return;
+	if (iobus_dev->reply_owner != REPLY_NONE)
+		return;
+	/* 周期广播最优先，到期后在当前帧发完、返回收到或超时后立即发出 */
+	for (i=0; i<iobus_dev->bcast_count; i++)
 	{
-		printk(KERN_ERR "the device has been opened is not iobus device!\n"); 
-		return -1;
+		if (iobus_dev->bcast_tab[i].pending)
+		{
+			iobus_dev->bcast_tab[i].pending = false;
+			hdlc_stage_frame(iobus_dev, &iobus_dev->bcast_tab[i].frame, iobus_dev->bcast_tab[i].frame.len);
+			return;
+		}
 	}
-	/* 保存用户自定义设备结构体指针 */
-	iobus_dev = container_of(inode->i_cdev, IOBUS_DEV, cdev);
-	filp->private_data = iobus_dev;
-	spin_lock_init(&iobus_dev->spinlock);
-	/* 初始化工作，包括gpio、hdlc寄存器、中断以及等待队列等 */
-	gpio_init(iobus_dev);
-	hdlc_init(iobus_dev);
-	if (request_irq(gpio_to_irq(GPIO4_15), &hdlc_interrupt_handler, IRQF_DISABLED, DEV_NAME, iobus_dev))
+	if (iobus_dev->xact_state == XACT_PENDING)
 	{
-		printk(KERN_ERR "can't request irq for gpio4_15!\n");
-		return -EAGAIN;
+		iobus_dev->xact_state = XACT_SENT;
+		reply_send(iobus_dev, &iobus_dev->xact_tx, REPLY_XACT, iobus_dev->xact_timeout);
+		return;
 	}
-	tasklet_init(&iobus_dev->recv_tasklet, recv_tasklet_func, (unsigned long)iobus_dev);
-	init_waitqueue_head(&iobus_dev->send_wq);
-	init_waitqueue_head(&iobus_dev->recv_wq);
-	return 0;
+	if (iobus_dev->scan_running && iobus_dev->scan_index < iobus_dev->scan_count)
+	{
+		entry = &iobus_dev->scan_tab[iobus_dev->scan_index];
+		iobus_dev->scan_tx.len = entry->len;
+		iobus_dev->scan_tx.addr = entry->addr;
+		iobus_dev->scan_tx.chan = entry->chan;
+		iobus_dev->scan_tx.flags = 0;
+		iobus_dev->scan_tx.tstamp = 0;
+		memcpy(iobus_dev->scan_tx.data, entry->data, entry->len);
+		/* 超时为0的表项无需返回，发送完成后直接执行下一项 */
+		if (entry->timeout_us == 0)
+		{
+			hdlc_stage_frame(iobus_dev, &iobus_dev->scan_tx, entry->len);
+			iobus_dev->scan_index++;
+		}
+		else
+			reply_send(iobus_dev, &iobus_dev->scan_tx, REPLY_SCAN,
+					   ktime_set(entry->timeout_us / USEC_PER_SEC, (entry->timeout_us % USEC_PER_SEC) * NSEC_PER_USEC));
+		return;
+	}
+	frame = tx_ring_next(iobus_dev, &len);
+	if (frame == NULL)
+		return;
+	/* 帧已拷入tx_stage，立即归还队列中的帧槽 */
+	hdlc_stage_frame(iobus_dev, frame, len);
+	ring_pop(&iobus_dev->tx_ring);
 }
 
-/** @brief 设备文件操作关闭函数 
+/**
+  * @brief  返回帧或超时结果写入按卡件地址索引的结果表，调用者需持有spinlock
+  *         frame为NULL表示超时，保留上次的返回数据
+  *         更新前后各把seq加1，用户态据此在mmap的结果表上无锁读取
   */
-static int iobus_close(struct inode *inode, struct file *filp)
+static void slot_store(IOBUS_DEV *iobus_dev, unsigned char addr, const IOBUS_FRAME *frame)
 {
-	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)filp->private_data;
-	free_irq(gpio_to_irq(GPIO4_15), iobus_dev);
-	tasklet_kill(&iobus_dev->recv_tasklet);
-	filp->private_data = NULL;
-	return 0;
+	IOBUS_SLOT *slot = &iobus_dev->slots[addr];
+	slot->seq++;
+	smp_wmb();
+	slot->cycle = iobus_dev->scan_cycle;
+	if (frame == NULL)
+		slot->status = IOBUS_SLOT_TIMEOUT;
+	else
+	{
+		slot->status = IOBUS_SLOT_VALID;
+		slot->len = frame->len;
+		slot->rsr = frame->rsr;
+		slot->tstamp = frame->tstamp;
+		memcpy(slot->data, frame->data, frame->len);
+	}
+	smp_wmb();
+	slot->seq++;
 }
-/** @brief 设备文件操作写函数，用于发送HDLC
+
+/**
+  * @brief  结束当前的等待返回，调用者需持有spinlock
+  *         frame为返回帧，NULL表示超时或出错重发后仍失败，由调用者分别计数
   */
-static ssize_t iobus_write(struct file *filp, const char __user* buf, size_t count, loff_t *pos)
+static void reply_complete(IOBUS_DEV *iobus_dev, const IOBUS_FRAME *frame)
 {
-	int ret = 0;
-	int addr = 0;
-	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)filp->private_data;
-	/* 如果HDLC控制器仍然未发送完成，用户层又进行一次数据发送过程，此时阻塞进程 */
-	while (iobus_dev->send_stat == BUSY)
+	int owner = iobus_dev->reply_owner;
+	unsigned char chan = 0;
+	iobus_dev->reply_owner = REPLY_NONE;
+	if (frame != NULL)
+		stat_hist(iobus_dev, IOBUS_HIST_REPLY, frame->tstamp - ktime_to_ns(iobus_dev->tx_start));
+	/* 重发才收到返回说明首发通道有故障，主备互换 */
+	if (iobus_dev->red_retry && frame != NULL)
 	{
-		if (filp->f_flags & O_NONBLOCK)
-			return -EAGAIN;
-		wait_event_interruptible(iobus_dev->send_wq, iobus_dev->send_stat == IDLE);
+		chan = iobus_dev->red_chan[0];
+		iobus_dev->red_chan[0] = iobus_dev->red_chan[1];
+		iobus_dev->red_chan[1] = chan;
+		STAT_INC(iobus_dev, red_failovers);
 	}
-	/* 用户空间数据拷贝到内核, 即接收到的网络数据包内容拷贝到内核*/ 
-	if (copy_from_user(iobus_dev->send_buf, buf, count))
+	iobus_dev->red_retry = false;
+	iobus_dev->err_retry = false;
+	if (owner == REPLY_XACT)
 	{
-		ret = -EFAULT;
-		return ret;
+		/* 事务的返回同样是该卡件的最新数据，超时不改变结果表 */
+		if (frame != NULL)
+			slot_store(iobus_dev, iobus_dev->xact_tx.addr, frame);
+		iobus_dev->xact_state = (frame != NULL) ? XACT_DONE : XACT_TIMEOUT;
+		wake_up_interruptible(&iobus_dev->xact_wq);
 	}
-	/* 拷贝到内核的网络数据写入CPLD发送双口RAM */
-	spin_lock_irq(&iobus_dev->spinlock);
-	for (addr=0; addr<count; addr++)
+	else if (owner == REPLY_SCAN)
 	{
-		write_cpld(iobus_dev, addr, iobus_dev->send_buf[addr]);
+		slot_store(iobus_dev, iobus_dev->scan_tx.addr, frame);
+		iobus_dev->scan_index++;
 	}
-	/* send_buf[0]内容为地址，把改地址写到RPAR寄存器中, 等待卡件返回数据 */
-	write_cpld(iobus_dev, RPAR, iobus_dev->send_buf[0]);
-	write_cpld(iobus_dev, TNUMR_L, (unsigned char)(count & 0xFF));
-	write_cpld(iobus_dev, TNUMR_H, (unsigned char)((count >> 8) & 0xFF));
-	/* 使能RS485发送，使能CPLD寄存器发送 */
-	write_cpld(iobus_dev, RXTXEN, RXTXEN_T);
-	write_cpld(iobus_dev, RTER, read_cpld(iobus_dev, RTER) | HSND_EN);
-	/* 设置发送状态为繁忙，用与在定时发送广播时对进程的阻塞 */
-	iobus_dev->send_stat = BUSY;
-	spin_unlock_irq(&iobus_dev->spinlock);
-	return count;
 }
-/**@brief 设备文件操作读函数, 用于接收HDLC数据
+
+/**
+  * @brief  等待返回期间收到出错的帧，调用者需持有spinlock
+  *         卡件只返回一次，继续等到超时没有意义：立即重发一次，冗余模式下按reply_retry换通道重发，
+  *         已重发过则立即按失败完成
+  *         发送完成中断尚未处理或帧尚未发出时不能改写发送双口RAM，仍由超时处理
   */
-static ssize_t iobus_read(struct file *filp, char __user *buf, size_t count, loff_t *pos)
+static void reply_error(IOBUS_DEV *iobus_dev)
 {
-	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)filp->private_data;
-	while (iobus_dev->recv_stat == BUSY)
-	{
-		if (filp->f_flags & O_NONBLOCK)
-			return -EAGAIN;
-		wait_event_interruptible(iobus_dev->recv_wq, iobus_dev->recv_stat == IDLE);
-	}
-	if (copy_to_user(buf, iobus_dev->recv_buf, iobus_dev->recv_bytes))
+	if (iobus_dev->send_stat == BUSY)
+		return;
+	hrtimer_try_to_cancel(&iobus_dev->reply_timer);
+	if (reply_retry(iobus_dev))
+		return;
+	if (!iobus_dev->red_enable && !iobus_dev->err_retry)
 	{
-		return -EFAULT;
+		iobus_dev->err_retry = true;
+		reply_resend(iobus_dev);
+		return;
 	}
-	iobus_dev->recv_stat = BUSY;
-	return iobus_dev->recv_bytes;
+	STAT_INC(iobus_dev, reply_failed);
+	reply_complete(iobus_dev, NULL);
+	hdlc_start_tx(iobus_dev);
 }
-	/* 实现IO阻塞 */
-static unsigned int iobus_poll(struct file *filp, struct poll_table_struct *poll_table)
+
+/**
+  * @brief  读取并锁存中断状态，接收完成时同时锁存接收状态，调用者需持有spinlock
+  *         ISR读清零，由中断顶半部和忙轮询调用
+  *         stamp为读ISR之前的时刻，作为接收完成或发送完成的时间戳，不含唤醒和调度延迟
+  * @retval 读到的ISR
+  */
+static unsigned char hdlc_latch_isr(IOBUS_DEV *iobus_dev, ktime_t stamp)
 {
-	unsigned int mask = 0;
-	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)filp->private_data;
+	unsigned char isr = read_cpld(iobus_dev, ISR);
+	if (isr & RMC)
+	{
+		iobus_dev->rmc_stamp = stamp;
+		iobus_dev->irq_rsr = read_cpld(iobus_dev, RSR);
+	}
+	if (isr & TMC)
+	{
+		iobus_dev->tmc_stamp = stamp;
+	}
+	iobus_dev->irq_isr |= isr & (RMC | TMC);
+	return isr;
+}
+
+/**
+  * @brief  HDLC中断顶半部
+  *         只读取ISR/RSR并锁存到设备结构中，双口RAM的读取在中断线程中完成
+  */
+static irqreturn_t hdlc_interrupt_handler(int irq, void *dev_id)
+{
+	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)dev_id;
+	unsigned char isr = 0;
+	unsigned char pending = 0;
+	unsigned int hold = 0;
+	ktime_t t0;
+	if (irq != iobus_dev->irq)	
+	{
+		printk(KERN_ERR "irq number dosen't matched!\n");
+		return IRQ_NONE;
+	}
+	spin_lock(&iobus_dev->spinlock);
+	t0 = ktime_get();
+	iobus_dev->irq_entry = t0;
+	STAT_INC(iobus_dev, irq);
+	/* 判断GPIO ISR 并且清除相应中断标志 */
+/* 总是读不到正确的值所以去掉该段代码
+	isr_gpio = ioread32(iobus_dev->gpio4_regs + GPIO4_ISR);
+	printk(KERN_ERR "%x\n", isr_gpio);
+	if (!(isr_gpio & 0x8000))
+	{	
+		printk(KERN_ERR "here\n");
+		return IRQ_NONE;
+	}*/
+//	iowrite32(ioread32(iobus_dev->gpio4_regs + GPIO4_ISR) & 0x00008000, iobus_dev->gpio4_regs + GPIO4_ISR);
+	isr = hdlc_latch_isr(iobus_dev, t0);
+	trace_iobus_irq(isr, iobus_dev->irq_rsr);
+	/* 中断合并：收到一帧后屏蔽中断，由中断线程轮询后续的帧 */
+	if ((isr & RMC) && iobus_dev->coalesce_budget && !iobus_dev->irq_masked)
+	{
+		iobus_dev->bus_ops->irq_mask(iobus_dev);
+		iobus_dev->irq_masked = true;
+	}
+	/* 统计持锁时间 */
+	hold = (unsigned int)ktime_to_ns(ktime_sub(ktime_get(), t0));
+	if (iobus_dev->irq_hold_count == 0 || hold < iobus_dev->irq_hold_min)
+		iobus_dev->irq_hold_min = hold;
+	if (hold > iobus_dev->irq_hold_max)
+		iobus_dev->irq_hold_max = hold;
+	iobus_dev->irq_hold_sum += hold;
+	iobus_dev->irq_hold_count++;
+	/* 按锁存的状态而不是本次读到的ISR决定是否唤醒：忙轮询可能已读清ISR并锁存，却没能取得process_mutex */
+	pending = iobus_dev->irq_isr;
+	spin_unlock(&iobus_dev->spinlock);
+	if (pending)
+		return IRQ_WAKE_THREAD;
+	/* 忙轮询读ISR时会先于中断清掉中断标志，此时不能报告为未处理中断，否则内核会关闭该中断 */
+	if (iobus_dev->busy_poll_us)
+		return IRQ_HANDLED;
+	return IRQ_NONE;
+}
+
+/**
+  * @brief  按卡件地址查找接收该帧的文件，调用者需持有spinlock
+  * @retval 没有文件匹配时返回NULL，该帧进入共享接收队列
+  */
+static IOBUS_FILE *rx_filter_match(IOBUS_DEV *iobus_dev, unsigned char card)
+{
+	IOBUS_FILE *file = NULL;
+	list_for_each_entry(file, &iobus_dev->rx_filters, filter_node)
+	{
+		if ((card & file->filter_mask) == (file->filter_addr & file->filter_mask))
+			return file;
+	}
+	return NULL;
+}
+
+/**
+  * @brief  读取CPLD接收双口RAM中的一帧，在中断线程中调用，调用者需持有process_mutex
+  *         有事务或扫描在等待返回时读入对应的返回帧，否则读入接收队列
+  *         分块读取，每块单独持锁，读完后重新使能接收
+  */
+static void hdlc_recv(IOBUS_DEV *iobus_dev, unsigned char rsr, ktime_t stamp)
+{
+	int addr = 0;
+	int len = 0;
+	int recv_bytes = 0;
+	int owner = REPLY_NONE;
+	unsigned int seq = 0;
+	unsigned char card = 0;
+	IOBUS_FRAME *frame = NULL;
+	IOBUS_FILE *file = NULL;
+	IOBUS_RING *ring = &iobus_dev->rx_ring;
+	wait_queue_head_t *wq = &iobus_dev->recv_wq;
+	spin_lock_irq(&iobus_dev->spinlock);
+	iobus_dev->rx_draining = true;
+	owner = iobus_dev->reply_owner;
+	seq = iobus_dev->reply_seq;
+	card = ctrl_reg(iobus_dev, RPAR);
+	if (owner == REPLY_XACT)
+		frame = &iobus_dev->xact_rx;
+	else if (owner == REPLY_SCAN)
+		frame = &iobus_dev->scan_rx;
+	else
+	{
+		/* 按帧自身的地址字节分发：RPAMR1不比较的位在RPAR中看不出来，不同地址的帧会落入同一过滤 */
+		card = read_cpld(iobus_dev, 0);
+		file = rx_filter_match(iobus_dev, card);
+		if (file != NULL)
+		{
+			ring = &file->filter_ring;
+			wq = &file->filter_wq;
+		}
+		/* 接收队列满时丢弃该帧，但仍需重新使能接收 */
+		frame = ring_push_slot(ring);
+	}
+	if (frame != NULL)
+		recv_bytes = (read_cpld(iobus_dev, RDN1) | (read_cpld(iobus_dev, RDN2) << 8)) & 0xFFFF;
+	spin_unlock_irq(&iobus_dev->spinlock);
+	if (frame == NULL)
+	{
+		STAT_INC(iobus_dev, rx_dropped);
+		if (printk_ratelimit())
+			printk(KERN_WARNING "iobus: rx ring full, frame dropped!\n");
+	}
+	else
+	{
+		/* 帧槽只有frame_max字节，超长的帧截断 */
+		if (recv_bytes > iobus_dev->frame_max)
+		{
+			STAT_INC(iobus_dev, rx_truncated);
+			recv_bytes = iobus_dev->frame_max;
+		}
+		trace_iobus_rmc(rsr, recv_bytes, owner);
+	/*  从CPLD接收双口RAM直接读取到目标帧，每次只读IOBUS_DRAIN_CHUNK字节，
+	 *  期间只持bus_lock，与发送双口RAM的写入按块交错 */
+		for (addr=0; addr<recv_bytes; addr+=len)
+		{
+			len = min(recv_bytes - addr, IOBUS_DRAIN_CHUNK);
+			read_cpld_burst(iobus_dev, addr, frame->data + addr, len);
+		}
+		frame->len = recv_bytes;
+		frame->rsr = rsr;
+		frame->addr = card;
+		frame->chan = ctrl_reg(iobus_dev, CHSEL);
+		frame->tstamp = ktime_to_ns(stamp);
+		STAT_INC(iobus_dev, rx_frames);
+		STAT_ADD(iobus_dev, rx_bytes, recv_bytes);
+	}
+	/*  因为接收完成后接收使能自动清零，需手动使能接收 */
+	spin_lock_irq(&iobus_dev->spinlock);
+	modify_rter(iobus_dev, HREC_EN, 0);
+	iobus_dev->rx_draining = false;
+	trace_iobus_rx_drain(recv_bytes, owner);
+	if (owner != REPLY_NONE)
+	{
+		/* 等待已超时或已被新的等待取代时丢弃这一迟到的返回帧 */
+		if (iobus_dev->reply_owner == owner && iobus_dev->reply_seq == seq)
+		{
+			hrtimer_try_to_cancel(&iobus_dev->reply_timer);
+			reply_complete(iobus_dev, frame);
+		}
+		else
+			STAT_INC(iobus_dev, reply_late);
+		/* 总线已释放，继续发送 */
+		hdlc_start_tx(iobus_dev);
+	}
+	spin_unlock_irq(&iobus_dev->spinlock);
+	/* 文件关闭时先从rx_filters摘除再等待process_mutex，这里的file在持有process_mutex期间一直有效 */
+	if (owner == REPLY_NONE && frame != NULL)
+	{
+		ring_push(ring);
+		wake_up_interruptible(wq);
+	}
+	/* 先交付接收帧，再写下一帧的发送双口RAM */
+	hdlc_tx_fill(iobus_dev);
+}
+
+/**
+  * @brief  接收出错(RSR非0)，在中断线程中调用
+  *         按RSR各位计数，立即重新使能接收；有等待返回时立即重发，
+  *         否则在使能IOBUS_IOC_RX_ERRORS时把len为0、带rsr的描述符放入接收队列
+  */
+static void hdlc_recv_error(IOBUS_DEV *iobus_dev, unsigned char rsr, ktime_t stamp)
+{
+	int b = 0;
+	int owner = REPLY_NONE;
+	unsigned char card = 0;
+	IOBUS_FRAME *frame = NULL;
+	IOBUS_FILE *file = NULL;
+	IOBUS_RING *ring = &iobus_dev->rx_ring;
+	wait_queue_head_t *wq = &iobus_dev->recv_wq;
+	STAT_INC(iobus_dev, rx_errors);
+	for (b=0; b<8; b++)
+	{
+		if (rsr & (1 << b))
+			STAT_INC(iobus_dev, rx_rsr[b]);
+	}
+	spin_lock_irq(&iobus_dev->spinlock);
+	/* 接收完成后接收使能自动清零，出错的帧同样需要重新使能，否则接收一直关闭 */
+	modify_rter(iobus_dev, HREC_EN, 0);
+	owner = iobus_dev->reply_owner;
+	if (owner != REPLY_NONE)
+	{
+		STAT_INC(iobus_dev, reply_errors);
+		reply_error(iobus_dev);
+	}
+	else if (iobus_dev->rx_err_report)
+	{
+		card = ctrl_reg(iobus_dev, RPAR);
+		file = rx_filter_match(iobus_dev, card);
+		if (file != NULL)
+		{
+			ring = &file->filter_ring;
+			wq = &file->filter_wq;
+		}
+		frame = ring_push_slot(ring);
+		if (frame != NULL)
+		{
+			frame->len = 0;
+			frame->rsr = rsr;
+			frame->addr = card;
+			frame->chan = ctrl_reg(iobus_dev, CHSEL);
+			frame->tstamp = ktime_to_ns(stamp);
+		}
+	}
+	spin_unlock_irq(&iobus_dev->spinlock);
+	if (owner != REPLY_NONE)
+		hdlc_tx_fill(iobus_dev);
+	trace_iobus_rmc(rsr, 0, owner);
+	if (frame != NULL)
+	{
+		ring_push(ring);
+		wake_up_interruptible(wq);
+	}
+}
+
+/**
+  * @brief  HDLC中断线程
+  *         接收完成：读取CPLD接收双口RAM
+  *         发送完成：设置RS485为接收，设置标志，发送下一帧并唤醒阻塞进程
+  */
+static void hdlc_process(IOBUS_DEV *iobus_dev)
+{
+	unsigned char isr = 0;
+	unsigned char rsr = 0;
+	ktime_t entry;
+	ktime_t rmc_stamp;
+	/* 取走顶半部锁存的状态 */
+	spin_lock_irq(&iobus_dev->spinlock);
+	isr = iobus_dev->irq_isr;
+	rsr = iobus_dev->irq_rsr;
+	entry = iobus_dev->irq_entry;
+	rmc_stamp = iobus_dev->rmc_stamp;
+	iobus_dev->irq_isr = 0;
+	spin_unlock_irq(&iobus_dev->spinlock);
+	if (isr & RMC)
+	{
+		if (rsr == 0)
+			hdlc_recv(iobus_dev, rsr, rmc_stamp);
+		else
+			hdlc_recv_error(iobus_dev, rsr, rmc_stamp);
+	}
+	if (isr & TMC)
+	{
+		spin_lock_irq(&iobus_dev->spinlock);
+		trace_iobus_tmc(iobus_dev->tx_len);
+		STAT_INC(iobus_dev, tx_frames);
+		STAT_ADD(iobus_dev, tx_bytes, iobus_dev->tx_len);
+		if (iobus_dev->tx_enqueue_ns != 0)
+			stat_hist(iobus_dev, IOBUS_HIST_TX_DONE, ktime_to_ns(iobus_dev->tmc_stamp) - iobus_dev->tx_enqueue_ns);
+		shm_tx_done(iobus_dev, ktime_to_ns(iobus_dev->tmc_stamp));
+		write_ctrl(iobus_dev, RXTXEN, RXTXEN_R);
+		modify_rter(iobus_dev, HREC_EN, 0);
+		iobus_dev->send_stat = IDLE;
+	/*  发送队列中还有帧则立即发送下一帧 */
+		hdlc_start_tx(iobus_dev);
+		spin_unlock_irq(&iobus_dev->spinlock);
+		wake_up_interruptible(&iobus_dev->send_wq);
+		hdlc_tx_fill(iobus_dev);
+	}
+	if (isr)
+		stat_hist_since(iobus_dev, IOBUS_HIST_IRQ_WAKE, entry);
+}
+
+/**
+  * @brief  是否有已锁存、尚未处理的收发完成
+  */
+static bool hdlc_irq_pending(IOBUS_DEV *iobus_dev)
+{
+	bool pending = false;
+	spin_lock_irq(&iobus_dev->spinlock);
+	pending = iobus_dev->irq_isr != 0;
+	spin_unlock_irq(&iobus_dev->spinlock);
+	return pending;
+}
+
+/**
+  * @brief  中断合并时的轮询，中断线程在中断屏蔽期间调用
+  *         连续处理后续的收发完成，直到处理了coalesce_budget个事件(接收和发送完成都计入)、
+  *         总线空闲超过coalesce_idle_us或轮询总时间超过IOBUS_COALESCE_MAX_POLL_US，
+  *         然后重新使能中断，空闲时的响应延迟与不合并时相同
+  */
+static void hdlc_irq_poll(IOBUS_DEV *iobus_dev)
+{
+	unsigned int events = 0;
+	unsigned char pending = 0;
+	unsigned int budget = iobus_dev->coalesce_budget;
+	ktime_t idle = ktime_set(0, iobus_dev->coalesce_idle_us * NSEC_PER_USEC);
+	ktime_t deadline = ktime_add(ktime_get(), idle);
+	ktime_t end = ktime_add_us(ktime_get(), IOBUS_COALESCE_MAX_POLL_US);
+	ktime_t now;
+	STAT_INC(iobus_dev, irq_poll);
+	while (events < budget && ktime_to_ns(ktime_sub(ktime_get(), end)) <= 0)
+	{
+		spin_lock_irq(&iobus_dev->spinlock);
+		now = ktime_get();
+		hdlc_latch_isr(iobus_dev, now);
+		pending = iobus_dev->irq_isr;
+		if (pending)
+			iobus_dev->irq_entry = now;
+		spin_unlock_irq(&iobus_dev->spinlock);
+		if (pending)
+		{
+			hdlc_process(iobus_dev);
+			if (pending & TMC)
+				events++;
+			if (pending & RMC)
+			{
+				events++;
+				STAT_INC(iobus_dev, irq_poll_frames);
+			}
+			deadline = ktime_add(ktime_get(), idle);
+			continue;
+		}
+		if (ktime_to_ns(ktime_sub(ktime_get(), deadline)) > 0)
+			break;
+		cpu_relax();
+	}
+	spin_lock_irq(&iobus_dev->spinlock);
+	iobus_dev->irq_masked = false;
+	iobus_dev->bus_ops->irq_unmask(iobus_dev);
+	spin_unlock_irq(&iobus_dev->spinlock);
+}
+
+static irqreturn_t hdlc_irq_thread(int irq, void *dev_id)
+{
+	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)dev_id;
+	mutex_lock(&iobus_dev->process_mutex);
+	/* 处理期间忙轮询锁存的状态因取不到process_mutex留给本线程，处理完才释放 */
+	do
+	{
+		hdlc_process(iobus_dev);
+		if (iobus_dev->irq_masked)
+			hdlc_irq_poll(iobus_dev);
+	} while (hdlc_irq_pending(iobus_dev));
+	mutex_unlock(&iobus_dev->process_mutex);
+	return IRQ_HANDLED;
+}
+
+/**
+  * @brief  忙轮询，在给定时间内反复读CPLD的ISR并就地处理，直到done条件满足
+  *         省去中断、唤醒和调度的延迟，代价是轮询期间占满一个CPU
+  *         中断线程正在处理时不抢，由中断线程完成
+  *         是否需要处理看锁存的irq_isr而不是本次读到的ISR：取不到process_mutex时状态留在irq_isr，
+  *         下一轮或中断线程释放锁前处理；返回前仍未处理则阻塞等锁后处理，不丢失收发完成事件
+  * @retval 条件满足返回true，超时或有信号返回false，之后调用者按原方式睡眠等待
+  */
+static bool hdlc_busy_poll(IOBUS_DEV *iobus_dev, bool (*done)(void *arg), void *arg)
+{
+	bool hit = true;
+	unsigned char isr = 0;
+	unsigned char pending = 0;
+	unsigned int budget = ACCESS_ONCE(iobus_dev->busy_poll_us);
+	ktime_t end = ktime_add_us(ktime_get(), budget);
+	ktime_t now;
+	while (!done(arg))
+	{
+		if (signal_pending(current) || ktime_to_ns(ktime_sub(ktime_get(), end)) > 0)
+		{
+			hit = false;
+			break;
+		}
+		spin_lock_irq(&iobus_dev->spinlock);
+		now = ktime_get();
+		isr = hdlc_latch_isr(iobus_dev, now);
+		if (isr & (RMC | TMC))
+			iobus_dev->irq_entry = now;
+		pending = iobus_dev->irq_isr;
+		spin_unlock_irq(&iobus_dev->spinlock);
+		if (pending && mutex_trylock(&iobus_dev->process_mutex))
+		{
+			hdlc_process(iobus_dev);
+			mutex_unlock(&iobus_dev->process_mutex);
+		}
+		else
+			cpu_relax();
+	}
+	/* 本轮锁存却没取得process_mutex的状态，持锁方可能已检查完irq_isr，这里补处理 */
+	if (hdlc_irq_pending(iobus_dev))
+	{
+		mutex_lock(&iobus_dev->process_mutex);
+		while (hdlc_irq_pending(iobus_dev))
+			hdlc_process(iobus_dev);
+		mutex_unlock(&iobus_dev->process_mutex);
+	}
+	if (hit)
+		STAT_INC(iobus_dev, busy_poll_hit);
+	else
+		STAT_INC(iobus_dev, busy_poll_miss);
+	return hit;
+}
+
+static bool rx_ready(void *arg)
+{
+	return !ring_empty((IOBUS_RING *)arg);
+}
+
+static bool xact_finished(void *arg)
+{
+	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)arg;
+	return iobus_dev->xact_state == XACT_DONE || iobus_dev->xact_state == XACT_TIMEOUT;
+}
+
+/**
+  * @brief  唤醒总线引擎线程处理事件，可在中断和定时器上下文中调用
+  */
+static void engine_kick(IOBUS_DEV *iobus_dev, int event)
+{
+	set_bit(event, &iobus_dev->engine_events);
+	wake_up_process(iobus_dev->engine_task);
+}
+
+/**
+  * @brief  等待返回超时定时器回调，只记录超时的等待序号并唤醒总线引擎线程
+  *         CPLD接收状态的复位在线程中完成
+  */
+static enum hrtimer_restart reply_timeout_func(struct hrtimer *timer)
+{
+	unsigned long flags = 0;
+	IOBUS_DEV *iobus_dev = container_of(timer, IOBUS_DEV, reply_timer);
+	bool expired = false;
+	spin_lock_irqsave(&iobus_dev->spinlock, flags);
+	/* 等锁期间返回帧已到达并启动了新的发送时，定时器已被重新排队，不属于本次超时；
+	 * 新的等待可能已选中帧但尚未发出，reply_seq已变，因此取定时器启动时的序号 */
+	if (!hrtimer_is_queued(timer))
+	{
+		iobus_dev->timeout_seq = iobus_dev->armed_seq;
+		expired = true;
+	}
+	spin_unlock_irqrestore(&iobus_dev->spinlock, flags);
+	if (expired)
+		engine_kick(iobus_dev, ENGINE_EV_TIMEOUT);
+	return HRTIMER_NORESTART;
+}
+
+/**
+  * @brief  扫描周期定时器回调，唤醒总线引擎线程开始新一轮扫描
+  */
+static enum hrtimer_restart scan_timer_func(struct hrtimer *timer)
+{
+	IOBUS_DEV *iobus_dev = container_of(timer, IOBUS_DEV, scan_timer);
+	hrtimer_forward_now(timer, iobus_dev->scan_period);
+	engine_kick(iobus_dev, ENGINE_EV_SCAN);
+	return HRTIMER_RESTART;
+}
+
+/**
+  * @brief  周期广播定时器回调，唤醒总线引擎线程标记到期的广播帧
+  */
+static enum hrtimer_restart bcast_timer_func(struct hrtimer *timer)
+{
+	IOBUS_DEV *iobus_dev = container_of(timer, IOBUS_DEV, bcast_timer);
+	engine_kick(iobus_dev, ENGINE_EV_BCAST);
+	return HRTIMER_NORESTART;
+}
+
+/**
+  * @brief  标记已到期的广播帧并按最早的下一次到期时刻重新启动定时器，调用者需持有spinlock
+  *         到期时刻按周期累加，不随发送延迟漂移；落后超过一个周期时从当前时刻重新计
+  */
+static void bcast_update(IOBUS_DEV *iobus_dev)
+{
+	unsigned int i = 0;
+	s64 now = ktime_to_ns(ktime_get());
+	s64 earliest = 0;
+	IOBUS_BCAST *bcast = NULL;
+	for (i=0; i<iobus_dev->bcast_count; i++)
+	{
+		bcast = &iobus_dev->bcast_tab[i];
+		if (bcast->next_ns <= now)
+		{
+			if (bcast->pending)
+				iobus_dev->bcast_overrun++;
+			bcast->pending = true;
+			bcast->frame.tstamp = bcast->next_ns;
+			bcast->next_ns += bcast->period_ns;
+			if (bcast->next_ns <= now)
+				bcast->next_ns = now + bcast->period_ns;
+		}
+		if (i == 0 || bcast->next_ns < earliest)
+			earliest = bcast->next_ns;
+	}
+	if (iobus_dev->bcast_count)
+		hrtimer_start(&iobus_dev->bcast_timer, ns_to_ktime(earliest), HRTIMER_MODE_ABS);
+}
+
+/**
+  * @brief  复位CPLD接收状态，用于等待返回超时或中止后，调用者需持有spinlock
+  *         若发送完成中断也未到来，同时把RS485切回接收并释放发送双口RAM
+  *         帧尚未发出(tx_staged)时发送双口RAM仍归hdlc_tx_fill，由其发现等待已取消后释放
+  */
+static void hdlc_rx_reset(IOBUS_DEV *iobus_dev)
+{
+	if (iobus_dev->send_stat == BUSY && !iobus_dev->tx_staged)
+	{
+		write_ctrl(iobus_dev, RXTXEN, RXTXEN_R);
+		iobus_dev->send_stat = IDLE;
+	}
+	/* 正在读取接收双口RAM时不能重新使能接收，读完后中断线程会使能 */
+	if (!iobus_dev->rx_draining)
+	{
+		modify_rter(iobus_dev, 0, HREC_EN);
+		modify_rter(iobus_dev, HREC_EN, 0);
+	}
+}
+
+/**
+  * @brief  总线引擎线程
+  *         处理等待返回超时和扫描周期开始，这些操作需访问总线，不能放在定时器回调中
+  */
+static int engine_thread(void *data)
+{
+	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)data;
+	iobus_set_fifo(current);
+	while (!kthread_should_stop())
+	{
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (iobus_dev->engine_events == 0)
+		{
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+		spin_lock_irq(&iobus_dev->spinlock);
+		if (test_and_clear_bit(ENGINE_EV_TIMEOUT, &iobus_dev->engine_events))
+		{
+			/* 定时器到期后返回帧可能已先到达，只处理序号一致的等待 */
+			if (iobus_dev->reply_owner != REPLY_NONE && iobus_dev->reply_seq == iobus_dev->timeout_seq)
+			{
+				hdlc_rx_reset(iobus_dev);
+				if (!reply_retry(iobus_dev))
+				{
+					STAT_INC(iobus_dev, reply_timeouts);
+					reply_complete(iobus_dev, NULL);
+				}
+			}
+		}
+		if (test_and_clear_bit(ENGINE_EV_BCAST, &iobus_dev->engine_events))
+			bcast_update(iobus_dev);
+		if (test_and_clear_bit(ENGINE_EV_SCAN, &iobus_dev->engine_events) && iobus_dev->scan_running)
+		{
+			/* 上一轮扫描未完成时跳过本轮 */
+			if (iobus_dev->scan_index < iobus_dev->scan_count)
+				iobus_dev->scan_overrun++;
+			else
+			{
+				iobus_dev->scan_index = 0;
+				iobus_dev->scan_cycle++;
+			}
+		}
+		hdlc_start_tx(iobus_dev);
+		spin_unlock_irq(&iobus_dev->spinlock);
+		hdlc_tx_fill(iobus_dev);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+/**
+  * @brief  请求/应答事务：发送一帧，等待卡件返回或超时
+  *         事务帧优先于发送队列中的帧发送，等待返回期间总线不发送其他帧
+  *         超时从启动发送开始计时，包含本帧的发送时间
+  */
+static int iobus_transact(IOBUS_DEV *iobus_dev, IOBUS_XACT __user *uxact)
+{
+	int ret = 0;
+	IOBUS_XACT xact;
+	if (copy_from_user(&xact, uxact, sizeof(xact)))
+		return -EFAULT;
+	if (xact.tx_len == 0 || xact.tx_len > iobus_dev->frame_max || xact.timeout_us == 0)
+		return -EINVAL;
+	if (mutex_lock_interruptible(&iobus_dev->xact_mutex))
+		return -ERESTARTSYS;
+	if (copy_from_user(iobus_dev->xact_tx.data, (const void __user *)(unsigned long)xact.tx_buf, xact.tx_len))
+	{
+		ret = -EFAULT;
+		goto out;
+	}
+	iobus_dev->xact_tx.len = xact.tx_len;
+	iobus_dev->xact_tx.addr = xact.addr;
+	iobus_dev->xact_tx.chan = xact.chan;
+	iobus_dev->xact_tx.flags = 0;
+	iobus_dev->xact_tx.tstamp = ktime_to_ns(ktime_get());
+	iobus_dev->xact_timeout = ktime_set(xact.timeout_us / USEC_PER_SEC, (xact.timeout_us % USEC_PER_SEC) * NSEC_PER_USEC);
+	spin_lock_irq(&iobus_dev->spinlock);
+	iobus_dev->xact_state = XACT_PENDING;
+	hdlc_start_tx(iobus_dev);
+	spin_unlock_irq(&iobus_dev->spinlock);
+	hdlc_tx_fill(iobus_dev);
+	/* 超时由总线引擎线程复位CPLD接收状态后置XACT_TIMEOUT */
+	if (iobus_dev->busy_poll_us)
+		hdlc_busy_poll(iobus_dev, xact_finished, iobus_dev);
+	wait_event_interruptible(iobus_dev->xact_wq,
+		iobus_dev->xact_state == XACT_DONE || iobus_dev->xact_state == XACT_TIMEOUT);
+	spin_lock_irq(&iobus_dev->spinlock);
+	if (iobus_dev->xact_state == XACT_DONE)
+		ret = 0;
+	else if (iobus_dev->xact_state == XACT_TIMEOUT)
+		ret = -ETIMEDOUT;
+	else
+	{
+		/* 被信号中断：已发出的帧需放弃等待并复位CPLD接收状态，然后释放总线 */
+		if (iobus_dev->xact_state == XACT_SENT)
+		{
+			hrtimer_try_to_cancel(&iobus_dev->reply_timer);
+			iobus_dev->reply_owner = REPLY_NONE;
+			iobus_dev->red_retry = false;
+			iobus_dev->err_retry = false;
+			hdlc_rx_reset(iobus_dev);
+		}
+		ret = -EINTR;
+	}
+	iobus_dev->xact_state = XACT_IDLE;
+	hdlc_start_tx(iobus_dev);
+	spin_unlock_irq(&iobus_dev->spinlock);
+	hdlc_tx_fill(iobus_dev);
+	if (ret)
+		goto out;
+	/* 返回帧拷贝到用户空间 */
+	xact.rx_len = min_t(__u16, iobus_dev->xact_rx.len, xact.rx_size);
+	xact.rsr = iobus_dev->xact_rx.rsr;
+	xact.tstamp = iobus_dev->xact_rx.tstamp;
+	if (copy_to_user((void __user *)(unsigned long)xact.rx_buf, iobus_dev->xact_rx.data, xact.rx_len) ||
+		copy_to_user(uxact, &xact, sizeof(xact)))
+		ret = -EFAULT;
+out:
+	mutex_unlock(&iobus_dev->xact_mutex);
+	return ret;
+}
+
+/**
+  * @brief  设置扫描表，扫描运行期间不能修改
+  */
+static int iobus_scan_set(IOBUS_DEV *iobus_dev, IOBUS_SCAN_CFG __user *ucfg)
+{
+	int i = 0;
+	IOBUS_SCAN_CFG cfg;
+	IOBUS_SCAN_ENTRY *tab = NULL;
+	IOBUS_SCAN_ENTRY *old = NULL;
+	if (copy_from_user(&cfg, ucfg, sizeof(cfg)))
+		return -EFAULT;
+	if (cfg.count == 0 || cfg.count > IOBUS_SCAN_MAX || cfg.period_us == 0)
+		return -EINVAL;
+	tab = vmalloc(cfg.count * sizeof(IOBUS_SCAN_ENTRY));
+	if (tab == NULL)
+		return -ENOMEM;
+	if (copy_from_user(tab, (const void __user *)(unsigned long)cfg.entries, cfg.count * sizeof(IOBUS_SCAN_ENTRY)))
+	{
+		vfree(tab);
+		return -EFAULT;
+	}
+	for (i=0; i<cfg.count; i++)
+	{
+		if (tab[i].len == 0 || tab[i].len > iobus_dev->frame_max)
+		{
+			vfree(tab);
+			return -EINVAL;
+		}
+	}
+	spin_lock_irq(&iobus_dev->spinlock);
+	if (iobus_dev->scan_running)
+	{
+		spin_unlock_irq(&iobus_dev->spinlock);
+		vfree(tab);
+		return -EBUSY;
+	}
+	old = iobus_dev->scan_tab;
+	iobus_dev->scan_tab = tab;
+	iobus_dev->scan_count = cfg.count;
+	iobus_dev->scan_index = cfg.count;
+	iobus_dev->scan_period = ktime_set(cfg.period_us / USEC_PER_SEC, (cfg.period_us % USEC_PER_SEC) * NSEC_PER_USEC);
+	spin_unlock_irq(&iobus_dev->spinlock);
+	vfree(old);
+	return 0;
+}
+
+/**
+  * @brief  启动/停止周期扫描
+  *         停止时正在等待的返回仍会写入结果表，当前这一轮的其余表项不再发送
+  */
+static int iobus_scan_start(IOBUS_DEV *iobus_dev)
+{
+	spin_lock_irq(&iobus_dev->spinlock);
+	if (iobus_dev->scan_tab == NULL)
+	{
+		spin_unlock_irq(&iobus_dev->spinlock);
+		return -EINVAL;
+	}
+	if (!iobus_dev->scan_running)
+	{
+		iobus_dev->scan_running = true;
+		iobus_dev->scan_index = iobus_dev->scan_count;
+		hrtimer_start(&iobus_dev->scan_timer, ktime_set(0, 0), HRTIMER_MODE_REL);
+	}
+	spin_unlock_irq(&iobus_dev->spinlock);
+	return 0;
+}
+
+static void iobus_scan_stop(IOBUS_DEV *iobus_dev)
+{
+	spin_lock_irq(&iobus_dev->spinlock);
+	iobus_dev->scan_running = false;
+	spin_unlock_irq(&iobus_dev->spinlock);
+	hrtimer_cancel(&iobus_dev->scan_timer);
+}
+
+/**
+  * @brief  设置周期广播帧，替换原有的全部广播，count为0时停止
+  *         各帧的第一次发送在设置后立即到期
+  */
+static int iobus_bcast_set(IOBUS_DEV *iobus_dev, IOBUS_BCAST_CFG __user *ucfg)
+{
+	unsigned int i = 0;
+	s64 now = 0;
+	IOBUS_BCAST_CFG cfg;
+	IOBUS_BCAST_ENTRY *entries = NULL;
+	IOBUS_BCAST *tab = NULL;
+	IOBUS_BCAST *old = NULL;
+	if (copy_from_user(&cfg, ucfg, sizeof(cfg)))
+		return -EFAULT;
+	if (cfg.count > IOBUS_BCAST_MAX)
+		return -EINVAL;
+	if (cfg.count)
+	{
+		entries = vmalloc(cfg.count * sizeof(IOBUS_BCAST_ENTRY));
+		tab = vmalloc(cfg.count * sizeof(IOBUS_BCAST));
+		if (entries == NULL || tab == NULL)
+		{
+			vfree(entries);
+			vfree(tab);
+			return -ENOMEM;
+		}
+		if (copy_from_user(entries, (const void __user *)(unsigned long)cfg.entries, cfg.count * sizeof(IOBUS_BCAST_ENTRY)))
+		{
+			vfree(entries);
+			vfree(tab);
+			return -EFAULT;
+		}
+		now = ktime_to_ns(ktime_get());
+		for (i=0; i<cfg.count; i++)
+		{
+			if (entries[i].len == 0 || entries[i].len > iobus_dev->frame_max || entries[i].period_us == 0)
+			{
+				vfree(entries);
+				vfree(tab);
+				return -EINVAL;
+			}
+			tab[i].period_ns = (s64)entries[i].period_us * NSEC_PER_USEC;
+			tab[i].next_ns = now;
+			tab[i].pending = false;
+			tab[i].frame.len = entries[i].len;
+			tab[i].frame.addr = 0;
+			tab[i].frame.chan = entries[i].chan;
+			tab[i].frame.flags = IOBUS_TXF_KEEP_RPAR;
+			memcpy(tab[i].frame.data, entries[i].data, entries[i].len);
+		}
+		vfree(entries);
+	}
+	spin_lock_irq(&iobus_dev->spinlock);
+	old = iobus_dev->bcast_tab;
+	iobus_dev->bcast_tab = NULL;
+	iobus_dev->bcast_count = 0;
+	spin_unlock_irq(&iobus_dev->spinlock);
+	hrtimer_cancel(&iobus_dev->bcast_timer);
+	spin_lock_irq(&iobus_dev->spinlock);
+	iobus_dev->bcast_tab = tab;
+	iobus_dev->bcast_count = cfg.count;
+	iobus_dev->bcast_overrun = 0;
+	bcast_update(iobus_dev);
+	hdlc_start_tx(iobus_dev);
+	spin_unlock_irq(&iobus_dev->spinlock);
+	hdlc_tx_fill(iobus_dev);
+	vfree(old);
+	return 0;
+}
+
+/**
+  * @brief  读取结果表中一张卡件的最近一次扫描结果
+  */
+static int iobus_scan_read(IOBUS_DEV *iobus_dev, IOBUS_SLOT __user *uslot)
+{
+	__u8 addr = 0;
+	IOBUS_SLOT *slot = NULL;
+	if (get_user(addr, &uslot->addr))
+		return -EFAULT;
+	slot = kmalloc(sizeof(IOBUS_SLOT), GFP_KERNEL);
+	if (slot == NULL)
+		return -ENOMEM;
+	spin_lock_irq(&iobus_dev->spinlock);
+	memcpy(slot, &iobus_dev->slots[addr], sizeof(IOBUS_SLOT));
+	spin_unlock_irq(&iobus_dev->spinlock);
+	slot->addr = addr;
+	if (copy_to_user(uslot, slot, sizeof(IOBUS_SLOT)))
+	{
+		kfree(slot);
+		return -EFAULT;
+	}
+	kfree(slot);
+	return 0;
+}
+
+/* 各CPLD总线控制器的管脚表，按实例序号索引 */
+static const IOBUS_BOARD_BUS iobus_board_buses[BOARD_BUS_NUM] = BOARD_BUSES;
+
+/**
+  * @brief  检查板级管脚表
+  *         管脚不能超出GPIO组；同一控制器的地址线、数据线、读写信号各占一组，
+  *         且这些组不与其他控制器共用，否则按实例维护的影子寄存器会互相覆盖
+  * @retval 0表示正确，-EINVAL表示管脚表有误
+  */
+static int board_check(void)
+{
+	int i = 0;
+	int j = 0;
+	for (i=0; i<BOARD_BUS_NUM; i++)
+	{
+		const IOBUS_BOARD_BUS *b = &iobus_board_buses[i];
+		unsigned char banks[3] = { b->addr_bank, b->data_bank, b->ctl_bank };
+		int k = 0;
+		bool bad = b->irq_bank < 1 || b->irq_bank > GPIO_BANK_NUM || b->irq_pin > 31 ||
+			b->addr_pin + BOARD_ADDR_WIDTH > 32 || b->data_pin + 8 > 32 ||
+			b->wr_pin > 31 || b->rd_pin > 31 || b->wr_pin == b->rd_pin;
+		for (k=0; k<3; k++)
+			bad = bad || banks[k] < 1 || banks[k] > GPIO_BANK_NUM;
+		if (bad)
+		{
+			printk(KERN_ERR "board %s bus %d: bad GPIO bank or pin!\n", BOARD_NAME, i);
+			return -EINVAL;
+		}
+		if (b->addr_bank == b->data_bank || b->addr_bank == b->ctl_bank || b->data_bank == b->ctl_bank)
+		{
+			printk(KERN_ERR "board %s bus %d: address, data and control lines must be on different GPIO banks!\n", BOARD_NAME, i);
+			return -EINVAL;
+		}
+		for (j=0; j<i; j++)
+		{
+			const IOBUS_BOARD_BUS *o = &iobus_board_buses[j];
+			for (k=0; k<3; k++)
+			{
+				if (banks[k] == o->addr_bank || banks[k] == o->data_bank || banks[k] == o->ctl_bank)
+				{
+					printk(KERN_ERR "board %s bus %d and bus %d share GPIO%d!\n", BOARD_NAME, j, i, banks[k]);
+					return -EINVAL;
+				}
+			}
+			if (b->irq_bank == o->irq_bank && b->irq_pin == o->irq_pin)
+			{
+				printk(KERN_ERR "board %s bus %d and bus %d share irq gpio%d_%d!\n", BOARD_NAME, j, i, b->irq_bank, b->irq_pin);
+				return -EINVAL;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+  * @brief  GPIO模拟总线后端
+  *         模块加载时映射IOMUX/GPIO寄存器并配置管脚，管脚与中断取自本实例在iobus_board.h中的管脚表
+  */
+static int gpio_bus_init(IOBUS_DEV *iobus_dev)
+{
+	const IOBUS_BOARD_BUS *board = NULL;
+	if (BOARD_SIM_ONLY)
+	{
+		printk(KERN_ERR "board %s is a sim-only layout, use bus=sim!\n", BOARD_NAME);
+		return -ENODEV;
+	}
+	if (iobus_dev->index >= BOARD_BUS_NUM)
+	{
+		printk(KERN_ERR "board %s has only %d CPLD bus!\n", BOARD_NAME, BOARD_BUS_NUM);
+		return -ENODEV;
+	}
+	board = &iobus_board_buses[iobus_dev->index];
+	iobus_dev->board = board;
+	iobus_dev->addr_shift = board->addr_pin;
+	iobus_dev->addr_msk = (BUS_ADDR_SPACE - 1) << board->addr_pin;
+	iobus_dev->data_shift = board->data_pin;
+	iobus_dev->data_msk = 0xFFU << board->data_pin;
+	iobus_dev->bus_wr = 1U << board->wr_pin;
+	iobus_dev->bus_rd = 1U << board->rd_pin;
+	/* 映射寄存器地址到内核虚拟空间 */
+	iobus_dev->iomux_regs = ioremap(IOMUX_BASE, IOMUX_MEM_SIZE);
+	if (iobus_dev->iomux_regs == NULL) 
+	{
+		printk(KERN_ERR "can't remap IOMUX memory to virtual address!\n");
+		goto ioremap_iomux_err;
+	}
+	iobus_dev->addr_regs = ioremap(GPIO_BANK_BASE(board->addr_bank), GPIO_MEM_SIZE);
+	if (iobus_dev->addr_regs == NULL)
+	{
+		printk(KERN_ERR "can't remap GPIO%d memory to virtual address!\n", board->addr_bank);
+		goto ioremap_addr_err;
+	}
+	iobus_dev->data_regs = ioremap(GPIO_BANK_BASE(board->data_bank), GPIO_MEM_SIZE);
+	if (iobus_dev->data_regs == NULL)
+	{
+		printk(KERN_ERR "can't remap GPIO%d memory to virtual address!\n", board->data_bank);
+		goto ioremap_data_err;
+	}
+	iobus_dev->ctl_regs = ioremap(GPIO_BANK_BASE(board->ctl_bank), GPIO_MEM_SIZE);
+	if (iobus_dev->ctl_regs == NULL)
+	{
+		printk(KERN_ERR "can't remap GPIO%d memory to virtual address!\n", board->ctl_bank);
+		goto ioremap_ctl_err;
+	}
+	/* 中断管脚可与总线管脚同组，只访问ICR/IMR，不涉及影子寄存器 */
+	iobus_dev->irq_regs = ioremap(GPIO_BANK_BASE(board->irq_bank), GPIO_MEM_SIZE);
+	if (iobus_dev->irq_regs == NULL)
+	{
+		printk(KERN_ERR "can't remap GPIO%d memory to virtual address!\n", board->irq_bank);
+		goto ioremap_irq_err;
+	}
+	iobus_dev->irq = gpio_to_irq(GPIO_NUMBER(board->irq_bank, board->irq_pin));
+	printk(KERN_INFO "%s: board %s bus %d\n", iobus_dev->name, BOARD_NAME, iobus_dev->index);
+	return 0;
+ioremap_irq_err:
+	iounmap(iobus_dev->ctl_regs);
+ioremap_ctl_err:
+	iounmap(iobus_dev->data_regs);
+ioremap_data_err:
+	iounmap(iobus_dev->addr_regs);
+ioremap_addr_err:
+	iounmap(iobus_dev->iomux_regs);
+ioremap_iomux_err:
+	return -ENOMEM;
+}
+
+static void gpio_bus_exit(IOBUS_DEV *iobus_dev)
+{
+	iounmap(iobus_dev->irq_regs);
+	iounmap(iobus_dev->ctl_regs);
+	iounmap(iobus_dev->data_regs);
+	iounmap(iobus_dev->addr_regs);
+	iounmap(iobus_dev->iomux_regs);
+}
+
+/* 顶半部用spin_lock持锁，须在关本地中断下运行，否则同一CPU上的hrtimer回调会在同一把锁上自旋；
+ * 2.6.35需显式给出IRQF_DISABLED，该标志去掉后的内核总是关中断调用顶半部
+ * 不使用IRQF_ONESHOT：中断为边沿触发，顶半部已读清CPLD的ISR，线程运行期间无需屏蔽中断线，
+ * 中断合并时由irq_mask/irq_unmask显式屏蔽 */
+#ifdef IRQF_DISABLED
+#define IOBUS_IRQ_FLAGS		IRQF_DISABLED
+#else
+#define IOBUS_IRQ_FLAGS		0
+#endif
+
+static int gpio_bus_irq_request(IOBUS_DEV *iobus_dev)
+{
+	if (request_threaded_irq(iobus_dev->irq, &hdlc_interrupt_handler, &hdlc_irq_thread, IOBUS_IRQ_FLAGS, iobus_dev->name, iobus_dev))
+	{
+		printk(KERN_ERR "can't request irq for gpio%d_%d!\n", iobus_dev->board->irq_bank, iobus_dev->board->irq_pin);
+		return -EAGAIN;
+	}
+	return 0;
+}
+
+static void gpio_bus_irq_free(IOBUS_DEV *iobus_dev)
+{
+	free_irq(iobus_dev->irq, iobus_dev);
+}
+
+/**
+  * @brief  屏蔽/使能板级定义的中断管脚
+  *         屏蔽期间到来的边沿由GPIO记录，使能后重新触发
+  */
+static void gpio_bus_irq_mask(IOBUS_DEV *iobus_dev)
+{
+	disable_irq_nosync(iobus_dev->irq);
+}
+
+static void gpio_bus_irq_unmask(IOBUS_DEV *iobus_dev)
+{
+	enable_irq(iobus_dev->irq);
+}
+
+static const IOBUS_BUS_OPS gpio_bus_ops = {
+	.name = "gpio",
+	.init = gpio_bus_init,
+	.exit = gpio_bus_exit,
+	.setup = gpio_init,
+	.write = gpio_write_cpld,
+	.read = gpio_read_cpld,
+	.write_burst = gpio_write_cpld_burst,
+	.read_burst = gpio_read_cpld_burst,
+	.irq_request = gpio_bus_irq_request,
+	.irq_free = gpio_bus_irq_free,
+	.irq_mask = gpio_bus_irq_mask,
+	.irq_unmask = gpio_bus_irq_unmask,
+};
+
+/**
+  * @brief  仿真CPLD后端，无需硬件即可测试驱动和测量驱动本身的开销
+  *         模拟发送/接收双口RAM、寄存器文件以及TMC/RMC中断：
+  *         写RTER置HSND_EN后经过 帧长*sim_byte_ns 产生TMC，
+  *         sim_echo时再经过sim_reply_us把发送帧原样作为返回帧放入接收双口RAM并产生RMC，
+  *         接收完成后HREC_EN自动清零，未使能接收时返回帧被丢弃，与CPLD一致
+  *         每次寄存器/双口RAM访问忙等sim_access_ns，模拟GPIO总线的访问时间
+  *         中断由sim_irq线程模拟：关中断调用顶半部，需要时再调用中断线程函数
+  *         仿真状态与真实总线一样由bus_lock保护
+  */
+static void sim_raise_irq(IOBUS_DEV *iobus_dev, unsigned char isr)
+{
+	IOBUS_SIM *sim = iobus_dev->sim;
+	if (!(sim->regs[IMR] & ((isr & TMC) ? TMC_EN : RMC_EN)))
+		return;
+	sim->isr |= isr;
+	if (sim->irq_masked)
+		return;
+	sim->irq_pending = true;
+	wake_up_process(sim->irq_task);
+}
+
+/**
+  * @brief  仿真中断屏蔽，调用者需持有spinlock，使能时有未读的中断状态则重新触发
+  */
+static void sim_bus_irq_mask(IOBUS_DEV *iobus_dev)
+{
+	unsigned long flags = 0;
+	spin_lock_irqsave(&iobus_dev->bus_lock, flags);
+	iobus_dev->sim->irq_masked = true;
+	spin_unlock_irqrestore(&iobus_dev->bus_lock, flags);
+}
+
+static void sim_bus_irq_unmask(IOBUS_DEV *iobus_dev)
+{
+	unsigned long flags = 0;
+	IOBUS_SIM *sim = iobus_dev->sim;
+	spin_lock_irqsave(&iobus_dev->bus_lock, flags);
+	sim->irq_masked = false;
+	if (sim->isr)
+	{
+		sim->irq_pending = true;
+		wake_up_process(sim->irq_task);
+	}
+	spin_unlock_irqrestore(&iobus_dev->bus_lock, flags);
+}
+
+static enum hrtimer_restart sim_tx_timer_func(struct hrtimer *timer)
+{
+	unsigned long flags = 0;
+	IOBUS_SIM *sim = container_of(timer, IOBUS_SIM, tx_timer);
+	IOBUS_DEV *iobus_dev = sim->iobus_dev;
+	spin_lock_irqsave(&iobus_dev->bus_lock, flags);
+	sim->regs[RTER] &= ~HSND_EN;
+	if (sim_echo)
+	{
+		memcpy(sim->reply, sim->tx_ram, sim->tx_len);
+		sim->reply_len = sim->tx_len;
+		hrtimer_start(&sim->rx_timer, ktime_set(0, sim_reply_us * NSEC_PER_USEC), HRTIMER_MODE_REL);
+	}
+	sim_raise_irq(iobus_dev, TMC);
+	spin_unlock_irqrestore(&iobus_dev->bus_lock, flags);
+	return HRTIMER_NORESTART;
+}
+
+static enum hrtimer_restart sim_rx_timer_func(struct hrtimer *timer)
+{
+	unsigned long flags = 0;
+	IOBUS_SIM *sim = container_of(timer, IOBUS_SIM, rx_timer);
+	IOBUS_DEV *iobus_dev = sim->iobus_dev;
+	spin_lock_irqsave(&iobus_dev->bus_lock, flags);
+	if (sim->regs[RTER] & HREC_EN)
+	{
+		memcpy(sim->rx_ram, sim->reply, sim->reply_len);
+		sim->regs[RDN1] = sim->reply_len & 0xFF;
+		sim->regs[RDN2] = sim->reply_len >> 8;
+		sim->regs[RSR] = 0;
+		sim->regs[RTER] &= ~HREC_EN;
+		sim_raise_irq(iobus_dev, RMC);
+	}
+	spin_unlock_irqrestore(&iobus_dev->bus_lock, flags);
+	return HRTIMER_NORESTART;
+}
+
+static int sim_irq_thread(void *data)
+{
+	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)data;
+	IOBUS_SIM *sim = iobus_dev->sim;
+	irqreturn_t ret = IRQ_NONE;
+	while (!kthread_should_stop())
+	{
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!sim->irq_pending)
+		{
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+		sim->irq_pending = false;
+		local_irq_disable();
+		ret = hdlc_interrupt_handler(iobus_dev->irq, iobus_dev);
+		local_irq_enable();
+		if (ret == IRQ_WAKE_THREAD)
+			hdlc_irq_thread(iobus_dev->irq, iobus_dev);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static void sim_write(IOBUS_DEV *iobus_dev, int addr, unsigned char data)
+{
+	IOBUS_SIM *sim = iobus_dev->sim;
+	ndelay(sim_access_ns);
+	addr &= CPLD_ADDR_SPACE - 1;
+	if (addr < IOBUS_FRAME_MAX)
+	{
+		sim->tx_ram[addr] = data;
+		return;
+	}
+	/* 发送进行中再次置HSND_EN不重新启动发送 */
+	if (addr == RTER && (data & HSND_EN) && !(sim->regs[RTER] & HSND_EN))
+	{
+		sim->tx_len = min((sim->regs[TNUMR_L] | (sim->regs[TNUMR_H] << 8)), IOBUS_FRAME_MAX);
+		hrtimer_start(&sim->tx_timer, ktime_set(0, sim->tx_len * sim_byte_ns), HRTIMER_MODE_REL);
+	}
+	sim->regs[addr] = data;
+}
+
+static unsigned char sim_read(IOBUS_DEV *iobus_dev, int addr)
+{
+	IOBUS_SIM *sim = iobus_dev->sim;
+	unsigned char data = 0;
+	ndelay(sim_access_ns);
+	addr &= CPLD_ADDR_SPACE - 1;
+	if (addr < IOBUS_FRAME_MAX)
+		return sim->rx_ram[addr];
+	/* ISR读清零 */
+	if (addr == ISR)
+	{
+		data = sim->isr;
+		sim->isr = 0;
+		return data;
+	}
+	return sim->regs[addr];
+}
+
+static void sim_write_burst(IOBUS_DEV *iobus_dev, int addr, const unsigned char *buf, int len)
+{
+	int i = 0;
+	for (i=0; i<len; i++)
+		sim_write(iobus_dev, addr + i, buf[i]);
+}
+
+static void sim_read_burst(IOBUS_DEV *iobus_dev, int addr, unsigned char *buf, int len)
+{
+	int i = 0;
+	for (i=0; i<len; i++)
+		buf[i] = sim_read(iobus_dev, addr + i);
+}
+
+static int sim_bus_init(IOBUS_DEV *iobus_dev)
+{
+	IOBUS_SIM *sim = kzalloc(sizeof(IOBUS_SIM), GFP_KERNEL);
+	if (sim == NULL)
+		return -ENOMEM;
+	sim->iobus_dev = iobus_dev;
+	iobus_hrtimer_init(&sim->tx_timer, sim_tx_timer_func);
+	iobus_hrtimer_init(&sim->rx_timer, sim_rx_timer_func);
+	iobus_dev->sim = sim;
+	iobus_dev->irq = -1;
+	return 0;
+}
+
+static void sim_bus_exit(IOBUS_DEV *iobus_dev)
+{
+	kfree(iobus_dev->sim);
+	iobus_dev->sim = NULL;
+}
+
+/**
+  * @brief  模块加载时复位仿真CPLD，与gpio后端的setup对应
+  */
+static void sim_bus_setup(IOBUS_DEV *iobus_dev)
+{
+	IOBUS_SIM *sim = iobus_dev->sim;
+	hrtimer_cancel(&sim->tx_timer);
+	hrtimer_cancel(&sim->rx_timer);
+	memset(sim->regs, 0, sizeof(sim->regs));
+	sim->isr = 0;
+	sim->irq_pending = false;
+	sim->irq_masked = false;
+}
+
+static int sim_bus_irq_request(IOBUS_DEV *iobus_dev)
+{
+	struct task_struct *task = kthread_create(sim_irq_thread, iobus_dev, "iobus_sim_irq%d", iobus_dev->index);
+	if (IS_ERR(task))
+	{
+		printk(KERN_ERR "can't create sim irq thread!\n");
+		return PTR_ERR(task);
+	}
+	iobus_set_fifo(task);
+	/* 仿真定时器停止前仍可能唤醒该线程，保留引用直到sim_bus_irq_free取消定时器之后 */
+	get_task_struct(task);
+	iobus_dev->sim->irq_task = task;
+	wake_up_process(task);
+	return 0;
+}
+
+/**
+  * @brief  先停止仿真中断线程，它在处理中断时会写RTER重新启动仿真定时器，再取消定时器
+  */
+static void sim_bus_irq_free(IOBUS_DEV *iobus_dev)
+{
+	IOBUS_SIM *sim = iobus_dev->sim;
+	kthread_stop(sim->irq_task);
+	hrtimer_cancel(&sim->tx_timer);
+	hrtimer_cancel(&sim->rx_timer);
+	put_task_struct(sim->irq_task);
+}
+
+static const IOBUS_BUS_OPS sim_bus_ops = {
+	.name = "sim",
+	.init = sim_bus_init,
+	.exit = sim_bus_exit,
+	.setup = sim_bus_setup,
+	.write = sim_write,
+	.read = sim_read,
+	.write_burst = sim_write_burst,
+	.read_burst = sim_read_burst,
+	.irq_request = sim_bus_irq_request,
+	.irq_free = sim_bus_irq_free,
+	.irq_mask = sim_bus_irq_mask,
+	.irq_unmask = sim_bus_irq_unmask,
+};
+
+/** @brief 设备文件操作打开函数
+  */
+static int iobus_open(struct inode *inode, struct file *filp)
+{
+	IOBUS_DEV *iobus_dev = NULL;
+	IOBUS_FILE *file = NULL;
+	/* 检查设备号是否对应iobus设备 */
+	if (MAJOR(inode->i_cdev->dev) != MAJOR(devno))
+	{
+		printk(KERN_ERR "the device has been opened is not iobus device!\n"); 
+		return -1;
+	}
+	/* 硬件已在模块加载时初始化，这里只分配每个打开文件的状态，可同时多次打开 */
+	iobus_dev = container_of(inode->i_cdev, IOBUS_DEV, cdev);
+	file = kzalloc(sizeof(IOBUS_FILE), GFP_KERNEL);
+	if (file == NULL)
+		return -ENOMEM;
+	file->iobus_dev = iobus_dev;
+	file->mode = IOBUS_MODE_RAW;
+	INIT_LIST_HEAD(&file->filter_node);
+	init_waitqueue_head(&file->filter_wq);
+	mutex_init(&file->filter_mutex);
+	file->rx_ring = &iobus_dev->rx_ring;
+	file->recv_wq = &iobus_dev->recv_wq;
+	file->recv_mutex = &iobus_dev->recv_mutex;
+	filp->private_data = file;
+#ifdef FMODE_NOWAIT
+	/* read_iter/write_iter遵守IOCB_NOWAIT */
+	filp->f_mode |= FMODE_NOWAIT;
+#endif
+	return 0;
+}
+
+/** @brief 设备文件操作关闭函数，只释放打开文件的状态
+  */
+static int iobus_close(struct inode *inode, struct file *filp)
+{
+	IOBUS_FILE *file = (IOBUS_FILE *)filp->private_data;
+	IOBUS_DEV *iobus_dev = file->iobus_dev;
+	if (file->filtered)
+	{
+		spin_lock_irq(&iobus_dev->spinlock);
+		list_del(&file->filter_node);
+		spin_unlock_irq(&iobus_dev->spinlock);
+		/* 等待正在向私有队列接收的中断线程退出 */
+		mutex_lock(&iobus_dev->process_mutex);
+		mutex_unlock(&iobus_dev->process_mutex);
+	}
+	vfree(file->rx_buf);
+	/* 周期扫描和发送队列中的帧与打开的文件无关，关闭后继续运行 */
+	kfree(file);
+	filp->private_data = NULL;
+	return 0;
+}
+/** @brief 用户空间的一帧放入发送队列
+  *        队列满时按阻塞/非阻塞方式等待，调用者需持有send_mutex
+  */
+int tx_enqueue(IOBUS_DEV *iobus_dev, bool nonblock, const IOBUS_TX_HDR *hdr, const char __user *data)
+{
+	IOBUS_FRAME *frame = NULL;
+	/* 发送队列已满时阻塞进程，直到中断线程发送完成腾出空间 */
+	while ((frame = ring_push_slot(&iobus_dev->tx_ring)) == NULL)
+	{
+		if (nonblock)
+		{
+			STAT_INC(iobus_dev, tx_eagain);
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(iobus_dev->send_wq, !ring_full(&iobus_dev->tx_ring)))
+			return -ERESTARTSYS;
+	}
+	/* 用户空间数据直接拷贝到发送队列中的帧 */
+	if (copy_from_user(frame->data, data, hdr->len))
+		return -EFAULT;
+	frame->len = hdr->len;
+	frame->addr = hdr->addr;
+	frame->chan = hdr->chan;
+	frame->flags = hdr->flags;
+	frame->tstamp = ktime_to_ns(ktime_get());
+	ring_push(&iobus_dev->tx_ring);
+	/* 硬件发送空闲时立即启动发送，否则由发送完成中断接着发送 */
+	spin_lock_irq(&iobus_dev->spinlock);
+	hdlc_start_tx(iobus_dev);
+	spin_unlock_irq(&iobus_dev->spinlock);
+	hdlc_tx_fill(iobus_dev);
+	return 0;
+}
+/** @brief 发送HDLC，write和异步写共用
+  *        RAW格式一次写一帧，首字节为卡件地址
+  *        FRAMED格式一次可写多帧，每帧为IOBUS_TX_HDR加数据，返回已入队的字节数
+  */
+static ssize_t iobus_do_write(IOBUS_FILE *file, const char __user* buf, size_t count, bool nonblock)
+{
+	int ret = 0;
+	size_t off = 0;
+	IOBUS_TX_HDR hdr;
+	IOBUS_DEV *iobus_dev = file->iobus_dev;
+	trace_iobus_write(count, file->mode);
+	if (count == 0)
+		return 0;
+	/* 共享区已映射时由用户态直接生产发送队列 */
+	if (atomic_read(&iobus_dev->mmap_count))
+		return -EBUSY;
+	if (mutex_lock_interruptible(&iobus_dev->send_mutex))
+		return -ERESTARTSYS;
+	if (file->mode == IOBUS_MODE_RAW)
+	{
+		if (count > iobus_dev->frame_max)
+		{
+			ret = -EINVAL;
+			goto out;
+		}
+		hdr.len = count;
+		hdr.chan = IOBUS_CHAN_KEEP;
+		hdr.flags = 0;
+		if (get_user(hdr.addr, (const unsigned char __user *)buf))
+		{
+			ret = -EFAULT;
+			goto out;
+		}
+		ret = tx_enqueue(iobus_dev, nonblock, &hdr, buf);
+		if (ret == 0)
+			off = count;
+		goto out;
+	}
+	while (off < count)
+	{
+		if (count - off < sizeof(hdr))
+		{
+			ret = -EINVAL;
+			break;
+		}
+		if (copy_from_user(&hdr, buf + off, sizeof(hdr)))
+		{
+			ret = -EFAULT;
+			break;
+		}
+		if (hdr.len == 0 || hdr.len > iobus_dev->frame_max || hdr.len > count - off - sizeof(hdr))
+		{
+			ret = -EINVAL;
+			break;
+		}
+		ret = tx_enqueue(iobus_dev, nonblock, &hdr, buf + off + sizeof(hdr));
+		if (ret)
+			break;
+		off += IOBUS_FRAME_ALIGN(sizeof(hdr) + hdr.len);
+	}
+	off = min(off, count);
+out:
+	mutex_unlock(&iobus_dev->send_mutex);
+	/* 已有帧入队时返回入队的字节数，否则返回错误 */
+	if (off > 0)
+		return off;
+	return ret;
+}
+/**@brief FRAMED格式的读函数，尽可能多地返回已接收的帧，至少一帧
+  */
+static ssize_t iobus_read_framed(IOBUS_RING *ring, unsigned int frame_max, char __user *buf, size_t count)
+{
+	size_t off = 0;
+	size_t need = 0;
+	IOBUS_RX_HDR hdr;
+	IOBUS_FRAME *frame = NULL;
+	while ((frame = ring_pop_slot(ring)) != NULL)
+	{
+		hdr.len = min_t(__u16, frame->len, frame_max);
+		need = IOBUS_FRAME_ALIGN(sizeof(hdr) + hdr.len);
+		if (off + sizeof(hdr) + hdr.len > count)
+			break;
+		hdr.rsr = frame->rsr;
+		hdr.chan = frame->chan;
+		hdr.addr = frame->addr;
+		memset(hdr.reserved, 0, sizeof(hdr.reserved));
+		hdr.tstamp = frame->tstamp;
+		if (copy_to_user(buf + off, &hdr, sizeof(hdr)) ||
+			copy_to_user(buf + off + sizeof(hdr), frame->data, hdr.len))
+		{
+			if (off == 0)
+				return -EFAULT;
+			break;
+		}
+		ring_pop(ring);
+		off += need;
+	}
+	/* 用户缓存连一帧都放不下 */
+	if (off == 0)
+		return -EMSGSIZE;
+	return min(off, count);
+}
+/**@brief 接收HDLC数据，read和异步读共用
+  */
+static ssize_t iobus_do_read(IOBUS_FILE *file, char __user *buf, size_t count, bool nonblock)
+{
+	int len = 0;
+	IOBUS_FRAME *frame = NULL;
+	IOBUS_DEV *iobus_dev = file->iobus_dev;
+	IOBUS_RING *ring = NULL;
+	wait_queue_head_t *wq = NULL;
+	struct mutex *lock = NULL;
+	/* 与iobus_set_rx_filter切换队列互斥，本次读取始终使用同一组队列 */
+	spin_lock_irq(&iobus_dev->spinlock);
+	ring = file->rx_ring;
+	wq = file->recv_wq;
+	lock = file->recv_mutex;
+	spin_unlock_irq(&iobus_dev->spinlock);
+	/* 共享区已映射时由用户态直接消费共享接收队列，私有队列不受影响 */
+	if (ring == &iobus_dev->rx_ring && atomic_read(&iobus_dev->mmap_count))
+		return -EBUSY;
+	/* 接收队列只允许一个消费者，多个打开者的读互斥 */
+	if (mutex_lock_interruptible(lock))
+		return -ERESTARTSYS;
+	for (;;)
+	{
+		frame = ring_pop_slot(ring);
+		/* RAW格式无法表示出错帧的描述符，直接丢弃 */
+		if (frame != NULL && frame->len == 0 && file->mode == IOBUS_MODE_RAW)
+		{
+			ring_pop(ring);
+			continue;
+		}
+		if (frame != NULL)
+			break;
+		if (nonblock)
+		{
+			len = -EAGAIN;
+			goto out;
+		}
+		if (iobus_dev->busy_poll_us && hdlc_busy_poll(iobus_dev, rx_ready, ring))
+			continue;
+		if (wait_event_interruptible(*wq, !ring_empty(ring)))
+		{
+			len = -ERESTARTSYS;
+			goto out;
+		}
+	}
+	if (file->mode == IOBUS_MODE_FRAMED)
+	{
+		len = iobus_read_framed(ring, iobus_dev->frame_max, buf, count);
+		trace_iobus_read(count, len);
+		goto out;
+	}
+	/* 用户缓存不足时截断该帧 */
+	len = min_t(size_t, min_t(size_t, frame->len, iobus_dev->frame_max), count);
+	if (copy_to_user(buf, frame->data, len))
+	{
+		len = -EFAULT;
+		goto out;
+	}
+	ring_pop(ring);
+	trace_iobus_read(count, len);
+out:
+	mutex_unlock(lock);
+	return len;
+}
+/**@brief 设备文件操作读写函数
+  */
+static ssize_t iobus_read(struct file *filp, char __user *buf, size_t count, loff_t *pos)
+{
+	return iobus_do_read((IOBUS_FILE *)filp->private_data, buf, count, filp->f_flags & O_NONBLOCK);
+}
+
+static ssize_t iobus_write(struct file *filp, const char __user *buf, size_t count, loff_t *pos)
+{
+	return iobus_do_write((IOBUS_FILE *)filp->private_data, buf, count, filp->f_flags & O_NONBLOCK);
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 11, 0)
+/**
+  * @brief  异步读写，2.6.35的aio重试模型
+  *         先把iocb的ki_wait挂到等待队列上再以非阻塞方式读写，避免丢失唤醒；
+  *         未就绪时保持挂接并返回-EIOCBRETRY，帧到达或发送队列腾出空间时唤醒函数kick_iocb，
+  *         aio在提交者的地址空间中重新调用，因而一个线程可同时挂起多个读写请求
+  *         同步kiocb(readv/writev)按原阻塞方式处理；每次只使用第一个iovec
+  */
+static ssize_t iobus_aio_read(struct kiocb *iocb, const struct iovec *iov, unsigned long nr_segs, loff_t pos)
+{
+	ssize_t ret = 0;
+	struct file *filp = iocb->ki_filp;
+	IOBUS_FILE *file = (IOBUS_FILE *)filp->private_data;
+	wait_queue_head_t *wq = ACCESS_ONCE(file->recv_wq);
+	if (nr_segs == 0)
+		return 0;
+	if (is_sync_kiocb(iocb))
+		return iobus_do_read(file, iov->iov_base, iov->iov_len, filp->f_flags & O_NONBLOCK);
+	add_wait_queue(wq, &iocb->ki_wait);
+	ret = iobus_do_read(file, iov->iov_base, iov->iov_len, true);
+	if (ret == -EAGAIN && !(filp->f_flags & O_NONBLOCK))
+		return -EIOCBRETRY;
+	remove_wait_queue(wq, &iocb->ki_wait);
+	return ret;
+}
+
+static ssize_t iobus_aio_write(struct kiocb *iocb, const struct iovec *iov, unsigned long nr_segs, loff_t pos)
+{
+	ssize_t ret = 0;
+	struct file *filp = iocb->ki_filp;
+	IOBUS_FILE *file = (IOBUS_FILE *)filp->private_data;
+	wait_queue_head_t *wq = &file->iobus_dev->send_wq;
+	if (nr_segs == 0)
+		return 0;
+	if (is_sync_kiocb(iocb))
+		return iobus_do_write(file, iov->iov_base, iov->iov_len, filp->f_flags & O_NONBLOCK);
+	add_wait_queue(wq, &iocb->ki_wait);
+	ret = iobus_do_write(file, iov->iov_base, iov->iov_len, true);
+	if (ret == -EAGAIN && !(filp->f_flags & O_NONBLOCK))
+		return -EIOCBRETRY;
+	remove_wait_queue(wq, &iocb->ki_wait);
+	return ret;
+}
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+/**
+  * @brief  read_iter/write_iter，较新内核上的异步读写
+  *         IOCB_NOWAIT(io_uring首次尝试)时不阻塞，返回-EAGAIN后io_uring经iobus_poll等待就绪再重试，
+  *         配合打开时设置的FMODE_NOWAIT，一个线程可同时挂起多个读写请求，不占用io-wq线程
+  *         只支持用户空间缓存，每次只使用第一段
+  */
+static char __user *iobus_iter_buf(struct iov_iter *iter, size_t *len)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	if (!user_backed_iter(iter))
+		return NULL;
+	*len = iter_iov_len(iter);
+	return iter_iov_addr(iter);
+#else
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+	if (iter_is_ubuf(iter))
+	{
+		*len = iov_iter_count(iter);
+		return iter->ubuf + iter->iov_offset;
+	}
+#endif
+	if (!iter_is_iovec(iter))
+		return NULL;
+	*len = min(iov_iter_count(iter), iter->iov->iov_len - iter->iov_offset);
+	return iter->iov->iov_base + iter->iov_offset;
+#endif
+}
+
+static ssize_t iobus_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	size_t len = 0;
+	ssize_t ret = 0;
+	struct file *filp = iocb->ki_filp;
+	char __user *buf = iobus_iter_buf(to, &len);
+	if (buf == NULL)
+		return -EINVAL;
+	ret = iobus_do_read((IOBUS_FILE *)filp->private_data, buf, len,
+		(filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT));
+	if (ret > 0)
+		iov_iter_advance(to, ret);
+	return ret;
+}
+
+static ssize_t iobus_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	size_t len = 0;
+	ssize_t ret = 0;
+	struct file *filp = iocb->ki_filp;
+	const char __user *buf = iobus_iter_buf(from, &len);
+	if (buf == NULL)
+		return -EINVAL;
+	ret = iobus_do_write((IOBUS_FILE *)filp->private_data, buf, len,
+		(filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT));
+	if (ret > 0)
+		iov_iter_advance(from, ret);
+	return ret;
+}
+#endif
+
+	/* 实现IO阻塞 */
+static unsigned int iobus_poll(struct file *filp, struct poll_table_struct *poll_table)
+{
+	unsigned int mask = 0;
+	IOBUS_FILE *file = (IOBUS_FILE *)filp->private_data;
+	IOBUS_DEV *iobus_dev = file->iobus_dev;
 	poll_wait(filp, &iobus_dev->send_wq, poll_table);
-	poll_wait(filp, &iobus_dev->recv_wq, poll_table);
+	poll_wait(filp, file->recv_wq, poll_table);
 	/* 如果驱动从CPLD接收双口RAM读取数据完成，则可以通知用户态取走数据 */
-	if (iobus_dev->recv_stat == IDLE)
+	if (!ring_empty(file->rx_ring))
 		mask |= POLLIN | POLLRDNORM;		
-	/* 如果CPLD硬件完成发送双口RAM的数据发送，则可以通知用户态继续写入数据到CPLD发送双口RAM */
-	/* 对于多数命令，用户态发送一帧后，需要等待模块的返回数据，不可能连续写入CPLD发送双口RAM，但对于定时组播等特殊命令，无需模块返回，需要阻塞以保证硬件的发送完成，如果连续快速的往CPLD发送双口RAM写入数据，有可能再 上一帧发送完毕之前覆盖双口RAM数据，导致发送数据错误，故此加入阻塞机制
+	/* 如果发送队列未满，则可以通知用户态继续写入数据 */
+	/* 对于多数命令，用户态发送一帧后，需要等待模块的返回数据，不可能连续写入，但对于定时组播等特殊命令，无需模块返回，可以连续写入多帧。发送双口RAM只在发送完成中断后由驱动写入下一帧，不会在上一帧发送完毕之前覆盖双口RAM数据，队列满时才阻塞
 	 */
-	if (iobus_dev->send_stat == IDLE)
+	if (!ring_full(&iobus_dev->tx_ring))
 		mask |= POLLOUT | POLLWRNORM;
 	return mask;
 }
 
-static int iobus_ioctl(struct inode *inode, struct file *filp, unsigned int cmd, unsigned long arg)
+static void iobus_vm_open(struct vm_area_struct *vma)
 {
-	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)filp->private_data;
+	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)vma->vm_private_data;
+	atomic_inc(&iobus_dev->mmap_count);
+}
+
+static void iobus_vm_close(struct vm_area_struct *vma)
+{
+	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)vma->vm_private_data;
+	atomic_dec(&iobus_dev->mmap_count);
+}
+
+static const struct vm_operations_struct iobus_vm_ops = {
+	.open = iobus_vm_open,
+	.close = iobus_vm_close,
+};
+
+/** @brief 把扫描结果表只读映射到用户态，多个进程可同时映射
+  *        结果表不参与read/write的互斥，映射期间仍可正常读写设备
+  */
+static int iobus_mmap_slots(IOBUS_DEV *iobus_dev, struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (vma->vm_end - vma->vm_start > PAGE_ALIGN(IOBUS_SLOT_NUM * sizeof(IOBUS_SLOT)))
+		return -EINVAL;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+	return remap_vmalloc_range(vma, iobus_dev->slots, 0);
+}
+
+/** @brief 设备文件操作映射函数，偏移0映射收发队列共享区，偏移IOBUS_SLOTS_OFFSET映射扫描结果表
+  *        用户态直接从接收队列取帧、向发送队列放帧，无需每帧一次系统调用和拷贝
+  *        发送队列的idle为1时，入队后需调用IOBUS_IOC_TX_KICK启动发送
+  */
+static int iobus_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	int ret = 0;
+	IOBUS_FILE *file = (IOBUS_FILE *)filp->private_data;
+	IOBUS_DEV *iobus_dev = file->iobus_dev;
+	IOBUS_SHM_HDR *hdr = (IOBUS_SHM_HDR *)iobus_dev->shm;
+	if (vma->vm_pgoff == (IOBUS_SLOTS_OFFSET >> PAGE_SHIFT))
+		return iobus_mmap_slots(iobus_dev, vma);
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > hdr->size)
+		return -EINVAL;
+	ret = remap_vmalloc_range(vma, iobus_dev->shm, 0);
+	if (ret)
+		return ret;
+	vma->vm_ops = &iobus_vm_ops;
+	vma->vm_private_data = iobus_dev;
+	iobus_vm_open(vma);
+	return 0;
+}
+
+/**
+  * @brief  批量读写CPLD寄存器，用于调试和卡件投运
+  *         所有操作在一次持锁内按顺序执行，只拷贝一次用户数据
+  *         驱动维护镜像的控制寄存器写入时同步更新镜像；
+  *         读ISR会清除中断标志，因此按中断顶半部的方式锁存，读完后交给中断处理，不丢失收发完成事件
+  */
+static int iobus_reg_batch(IOBUS_DEV *iobus_dev, IOBUS_REG_BATCH __user *ubatch)
+{
+	int i = 0;
+	unsigned char pending = 0;
+	IOBUS_REG_BATCH batch;
+	IOBUS_REG_OP ops[IOBUS_REG_BATCH_MAX];
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	if (batch.count == 0 || batch.count > IOBUS_REG_BATCH_MAX)
+		return -EINVAL;
+	if (copy_from_user(ops, (void __user *)(unsigned long)batch.ops, batch.count * sizeof(IOBUS_REG_OP)))
+		return -EFAULT;
+	for (i=0; i<batch.count; i++)
+	{
+		/* 板上只译码BOARD_ADDR_WIDTH根地址线，更高的地址会回绕到双口RAM */
+		if (ops[i].op > IOBUS_REG_WRITE || ops[i].addr < CPLD_CTRL_BASE || ops[i].addr >= BUS_ADDR_SPACE)
+			return -EINVAL;
+	}
+	spin_lock_irq(&iobus_dev->spinlock);
+	for (i=0; i<batch.count; i++)
+	{
+		if (ops[i].op == IOBUS_REG_WRITE)
+		{
+			if (ops[i].addr < CPLD_CTRL_BASE + CPLD_CTRL_NUM)
+				write_ctrl(iobus_dev, ops[i].addr, ops[i].value);
+			else
+				write_cpld(iobus_dev, ops[i].addr, ops[i].value);
+		}
+		else if (ops[i].addr == ISR)
+			ops[i].value = hdlc_latch_isr(iobus_dev, ktime_get());
+		else
+			ops[i].value = read_cpld(iobus_dev, ops[i].addr);
+	}
+	pending = iobus_dev->irq_isr;
+	if (pending)
+		iobus_dev->irq_entry = ktime_get();
+	spin_unlock_irq(&iobus_dev->spinlock);
+	if (pending)
+	{
+		mutex_lock(&iobus_dev->process_mutex);
+		hdlc_process(iobus_dev);
+		mutex_unlock(&iobus_dev->process_mutex);
+	}
+	if (copy_to_user((void __user *)(unsigned long)batch.ops, ops, batch.count * sizeof(IOBUS_REG_OP)))
+		return -EFAULT;
+	return 0;
+}
+
+/**
+  * @brief  设置中断合并参数，budget为0时关闭
+  */
+static int iobus_set_coalesce(IOBUS_DEV *iobus_dev, IOBUS_COALESCE __user *ucfg)
+{
+	IOBUS_COALESCE cfg;
+	if (copy_from_user(&cfg, ucfg, sizeof(cfg)))
+		return -EFAULT;
+	if (cfg.budget && (cfg.idle_us == 0 || cfg.idle_us > IOBUS_COALESCE_MAX_IDLE_US))
+		return -EINVAL;
+	/* 中断线程正在轮询时等它结束，使新参数从下一次合并开始生效 */
+	mutex_lock(&iobus_dev->process_mutex);
+	iobus_dev->coalesce_budget = cfg.budget;
+	iobus_dev->coalesce_idle_us = cfg.idle_us;
+	mutex_unlock(&iobus_dev->process_mutex);
+	return 0;
+}
+
+/**
+  * @brief  设置本文件的接收地址过滤
+  *         第一次设置时分配私有接收队列，深度与共享接收队列相同，此后read/poll只看私有队列
+  *         可重复设置以修改地址和掩码，关闭文件时取消
+  */
+static int iobus_set_rx_filter(IOBUS_FILE *file, IOBUS_RX_FILTER __user *ufilter)
+{
+	IOBUS_RX_FILTER filter;
+	IOBUS_DEV *iobus_dev = file->iobus_dev;
+	unsigned int depth = iobus_dev->rx_ring.mask + 1;
+	unsigned int off = ALIGN(sizeof(IOBUS_RING_CTL), IOBUS_CACHELINE);
+	void *buf = NULL;
+	if (copy_from_user(&filter, ufilter, sizeof(filter)))
+		return -EFAULT;
+	if (ACCESS_ONCE(file->rx_buf) == NULL)
+	{
+		buf = vmalloc(off + depth * iobus_dev->rx_ring.stride);
+		if (buf == NULL)
+			return -ENOMEM;
+	}
+	spin_lock_irq(&iobus_dev->spinlock);
+	file->filter_addr = filter.addr;
+	file->filter_mask = filter.mask;
+	if (!file->filtered && buf != NULL)
+	{
+		ring_init(&file->filter_ring, (IOBUS_RING_CTL *)buf, buf, off, depth, iobus_dev->rx_ring.stride);
+		file->rx_buf = buf;
+		buf = NULL;
+		list_add_tail(&file->filter_node, &iobus_dev->rx_filters);
+		file->filtered = true;
+		file->rx_ring = &file->filter_ring;
+		file->recv_wq = &file->filter_wq;
+		file->recv_mutex = &file->filter_mutex;
+	}
+	spin_unlock_irq(&iobus_dev->spinlock);
+	/* 并发设置时另一方已装好私有队列 */
+	vfree(buf);
+	return 0;
+}
+
+static int iobus_set_redundant(IOBUS_DEV *iobus_dev, IOBUS_REDUNDANT __user *ucfg)
+{
+	IOBUS_REDUNDANT cfg;
+	if (copy_from_user(&cfg, ucfg, sizeof(cfg)))
+		return -EFAULT;
+	if (cfg.enable && (cfg.primary > CHALLSEL || cfg.backup > CHALLSEL || cfg.primary == cfg.backup))
+		return -EINVAL;
+	/* 正在进行的重发不受影响，新设置从下一次等待开始生效 */
+	spin_lock_irq(&iobus_dev->spinlock);
+	iobus_dev->red_enable = cfg.enable;
+	iobus_dev->red_chan[0] = cfg.primary;
+	iobus_dev->red_chan[1] = cfg.backup;
+	spin_unlock_irq(&iobus_dev->spinlock);
+	return 0;
+}
+
+static long iobus_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	IOBUS_FILE *file = (IOBUS_FILE *)filp->private_data;
+	IOBUS_DEV *iobus_dev = file->iobus_dev;
 	if (_IOC_TYPE(cmd) != IOBUS_IOC_MAGIC)
 		return -ENOTTY;
 	if (_IOC_NR(cmd) > IOBUS_IOC_MAXNR)
 		return -ENOTTY;
+	/* 需访问用户空间或会睡眠的命令不能在持锁时处理 */
+	switch (cmd)
+	{
+		case IOBUS_IOC_SHM_SIZE:
+			return put_user(((IOBUS_SHM_HDR *)iobus_dev->shm)->size, (int __user *)arg);
+		case IOBUS_IOC_TRANSACT:
+			return iobus_transact(iobus_dev, (IOBUS_XACT __user *)arg);
+		case IOBUS_IOC_SCAN_SET:
+			return iobus_scan_set(iobus_dev, (IOBUS_SCAN_CFG __user *)arg);
+		case IOBUS_IOC_SCAN_START:
+			return iobus_scan_start(iobus_dev);
+		case IOBUS_IOC_SCAN_STOP:
+			iobus_scan_stop(iobus_dev);
+			return 0;
+		case IOBUS_IOC_SCAN_READ:
+			return iobus_scan_read(iobus_dev, (IOBUS_SLOT __user *)arg);
+		case IOBUS_IOC_COALESCE:
+			return iobus_set_coalesce(iobus_dev, (IOBUS_COALESCE __user *)arg);
+		case IOBUS_IOC_REG_BATCH:
+			return iobus_reg_batch(iobus_dev, (IOBUS_REG_BATCH __user *)arg);
+		case IOBUS_IOC_BCAST_SET:
+			return iobus_bcast_set(iobus_dev, (IOBUS_BCAST_CFG __user *)arg);
+		case IOBUS_IOC_REDUNDANT:
+			return iobus_set_redundant(iobus_dev, (IOBUS_REDUNDANT __user *)arg);
+		case IOBUS_IOC_RX_FILTER:
+			return iobus_set_rx_filter(file, (IOBUS_RX_FILTER __user *)arg);
+		default:
+			break;
+	}
 	spin_lock_irq(&iobus_dev->spinlock);
 	switch(cmd)
 	{
 		case IOBUS_IOC_RUN_STAT:
 			if (arg == 0)
-				write_cpld(iobus_dev, RUNSTAT, RUNSTAT_S);	
+				write_ctrl(iobus_dev, RUNSTAT, RUNSTAT_S);	
 			else
-				write_cpld(iobus_dev, RUNSTAT, RUNSTAT_M);
+				write_ctrl(iobus_dev, RUNSTAT, RUNSTAT_M);
 			break;
 		case IOBUS_IOC_CH_SEL:
-			write_cpld(iobus_dev, CHSEL, arg);
+			write_ctrl(iobus_dev, CHSEL, arg);
 			break;	
 		case IOBUS_IOC_LED_STAT:
-			write_cpld(iobus_dev, LED, arg);
+			write_ctrl(iobus_dev, LED, arg);
+			break;
+		case IOBUS_IOC_RX_ERRORS:
+			iobus_dev->rx_err_report = (arg != 0);
+			break;
+		case IOBUS_IOC_BUSY_POLL:
+			iobus_dev->busy_poll_us = min_t(unsigned long, arg, IOBUS_BUSY_POLL_MAX_US);
+			break;
+		case IOBUS_IOC_STATS_RESET:
+			iobus_stats_reset(iobus_dev);
+			break;
+		case IOBUS_IOC_TX_KICK:
+			hdlc_start_tx(iobus_dev);
+			break;
+		case IOBUS_IOC_SET_MODE:
+			if (arg == IOBUS_MODE_FRAMED)
+				file->mode = IOBUS_MODE_FRAMED;
+			else
+				file->mode = IOBUS_MODE_RAW;
 			break;
 		default:
 			break;
 	}
 	spin_unlock_irq(&iobus_dev->spinlock);
+	if (cmd == IOBUS_IOC_TX_KICK)
+		hdlc_tx_fill(iobus_dev);
 	return 0;
 } 
 
+/**
+  * @brief  debugfs总线测速
+  *         向/sys/kernel/debug/iobusN/bench写入迭代次数N后依次测量：
+  *           reg_write   写一次TNUMR_L(每帧发送前都会重写)
+  *           reg_read    读一次RDN1(无副作用)
+  *           burst_write 向发送双口RAM连续写256字节
+  *           burst_read  从接收双口RAM连续读256字节
+  *         每次迭代单独持锁并用ktime计时，硬件正在发送时跳过该次迭代，不破坏正在发送的帧
+  *         读bench得到各项的min/avg/p99/max(ns)及中断顶半部自上次测速以来的持锁时间
+  */
+#define BENCH_REG_WRITE		0
+#define BENCH_REG_READ		1
+#define BENCH_BURST_WRITE	2
+#define BENCH_BURST_READ	3
+#define BENCH_NUM			4
+
+static const char *bench_names[BENCH_NUM] = { "reg_write", "reg_read", "burst_write", "burst_read" };
+
+static int bench_cmp(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+  * @brief  测量一项，成功返回实际完成的迭代次数
+  */
+static unsigned int bench_run(IOBUS_DEV *iobus_dev, int test, unsigned int *samples, unsigned int iters, unsigned char *buf)
+{
+	unsigned int i = 0;
+	unsigned int n = 0;
+	unsigned int retry = 0;
+	ktime_t t0;
+	for (i=0; i<iters && retry<iters; )
+	{
+		spin_lock_irq(&iobus_dev->spinlock);
+		if (iobus_dev->send_stat == BUSY)
+		{
+			spin_unlock_irq(&iobus_dev->spinlock);
+			retry++;
+			cpu_relax();
+			continue;
+		}
+		t0 = ktime_get();
+		switch (test)
+		{
+			case BENCH_REG_WRITE:
+				write_cpld(iobus_dev, TNUMR_L, (unsigned char)i);
+				break;
+			case BENCH_REG_READ:
+				buf[0] = read_cpld(iobus_dev, RDN1);
+				break;
+			case BENCH_BURST_WRITE:
+				write_cpld_burst(iobus_dev, 0, buf, IOBUS_FRAME_MAX);
+				break;
+			case BENCH_BURST_READ:
+				read_cpld_burst(iobus_dev, 0, buf, IOBUS_FRAME_MAX);
+				break;
+		}
+		samples[n++] = (unsigned int)ktime_to_ns(ktime_sub(ktime_get(), t0));
+		spin_unlock_irq(&iobus_dev->spinlock);
+		i++;
+		if ((i & 0xFF) == 0)
+			cond_resched();
+	}
+	return n;
+}
+
+static int bench_all(IOBUS_DEV *iobus_dev, unsigned int iters)
+{
+	int test = 0;
+	unsigned int i = 0;
+	unsigned int n = 0;
+	unsigned long long sum = 0;
+	unsigned int hold_min = 0, hold_max = 0, hold_count = 0;
+	unsigned long long hold_sum = 0;
+	size_t len = 0;
+	unsigned int *samples = NULL;
+	unsigned char *buf = NULL;
+	char *out = iobus_dev->bench_result;
+	samples = vmalloc(iters * sizeof(unsigned int));
+	buf = kzalloc(IOBUS_FRAME_MAX, GFP_KERNEL);
+	if (samples == NULL || buf == NULL)
+	{
+		vfree(samples);
+		kfree(buf);
+		return -ENOMEM;
+	}
+	len += scnprintf(out + len, IOBUS_BENCH_RESULT_SIZE - len, "bus %s, %u iterations, burst %d bytes\n",
+		iobus_dev->bus_ops->name, iters, IOBUS_FRAME_MAX);
+	len += scnprintf(out + len, IOBUS_BENCH_RESULT_SIZE - len, "%-12s %8s %8s %8s %8s %8s\n",
+		"test", "n", "min", "avg", "p99", "max");
+	for (test=0; test<BENCH_NUM; test++)
+	{
+		n = bench_run(iobus_dev, test, samples, iters, buf);
+		if (n == 0)
+		{
+			len += scnprintf(out + len, IOBUS_BENCH_RESULT_SIZE - len, "%-12s bus busy\n", bench_names[test]);
+			continue;
+		}
+		sort(samples, n, sizeof(unsigned int), bench_cmp, NULL);
+		for (i=0, sum=0; i<n; i++)
+			sum += samples[i];
+		do_div(sum, n);
+		len += scnprintf(out + len, IOBUS_BENCH_RESULT_SIZE - len, "%-12s %8u %8u %8llu %8u %8u\n",
+			bench_names[test], n, samples[0], sum, samples[(n - 1) * 99 / 100], samples[n - 1]);
+	}
+	/* 取出并清零中断顶半部持锁时间 */
+	spin_lock_irq(&iobus_dev->spinlock);
+	hold_min = iobus_dev->irq_hold_min;
+	hold_max = iobus_dev->irq_hold_max;
+	hold_sum = iobus_dev->irq_hold_sum;
+	hold_count = iobus_dev->irq_hold_count;
+	iobus_dev->irq_hold_min = 0;
+	iobus_dev->irq_hold_max = 0;
+	iobus_dev->irq_hold_sum = 0;
+	iobus_dev->irq_hold_count = 0;
+	spin_unlock_irq(&iobus_dev->spinlock);
+	if (hold_count)
+		do_div(hold_sum, hold_count);
+	len += scnprintf(out + len, IOBUS_BENCH_RESULT_SIZE - len, "%-12s %8u %8u %8llu %8s %8u\n",
+		"irq_hold", hold_count, hold_min, hold_sum, "-", hold_max);
+	iobus_dev->bench_result_len = len;
+	vfree(samples);
+	kfree(buf);
+	return 0;
+}
+
+static ssize_t bench_write(struct file *filp, const char __user *ubuf, size_t count, loff_t *pos)
+{
+	int ret = 0;
+	char kbuf[16];
+	unsigned long iters = 0;
+	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)filp->private_data;
+	if (count >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, ubuf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+	iters = simple_strtoul(kbuf, NULL, 0);
+	if (iters == 0 || iters > IOBUS_BENCH_MAX_ITERS)
+		return -EINVAL;
+	mutex_lock(&iobus_dev->bench_mutex);
+	ret = bench_all(iobus_dev, iters);
+	mutex_unlock(&iobus_dev->bench_mutex);
+	return ret ? ret : count;
+}
+
+static ssize_t bench_read(struct file *filp, char __user *ubuf, size_t count, loff_t *pos)
+{
+	ssize_t ret = 0;
+	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)filp->private_data;
+	mutex_lock(&iobus_dev->bench_mutex);
+	ret = simple_read_from_buffer(ubuf, count, pos, iobus_dev->bench_result, iobus_dev->bench_result_len);
+	mutex_unlock(&iobus_dev->bench_mutex);
+	return ret;
+}
+
+static int bench_open(struct inode *inode, struct file *filp)
+{
+	filp->private_data = inode->i_private;
+	return 0;
+}
+
+static const struct file_operations bench_fops = {
+	.owner = THIS_MODULE,
+	.open = bench_open,
+	.read = bench_read,
+	.write = bench_write,
+};
+
+static const char *hist_names[IOBUS_HIST_NUM] = { "irq_to_wakeup", "write_to_tmc", "tx_to_reply" };
+
+/**
+  * @brief  debugfs的stats文件，输出各计数及非空的直方图桶
+  */
+static int stats_show(struct seq_file *m, void *v)
+{
+	int h = 0;
+	int b = 0;
+	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)m->private;
+	IOBUS_STATS *sum = kmalloc(sizeof(IOBUS_STATS), GFP_KERNEL);
+	if (sum == NULL)
+		return -ENOMEM;
+	iobus_stats_sum(iobus_dev, sum);
+	seq_printf(m, "irq            %lu\n", sum->irq);
+	seq_printf(m, "tx_frames      %lu\n", sum->tx_frames);
+	seq_printf(m, "tx_bytes       %lu\n", sum->tx_bytes);
+	seq_printf(m, "tx_eagain      %lu\n", sum->tx_eagain);
+	seq_printf(m, "tx_invalid     %lu\n", sum->tx_invalid);
+	seq_printf(m, "rx_frames      %lu\n", sum->rx_frames);
+	seq_printf(m, "rx_bytes       %lu\n", sum->rx_bytes);
+	seq_printf(m, "rx_errors      %lu\n", sum->rx_errors);
+	seq_printf(m, "rx_truncated   %lu\n", sum->rx_truncated);
+	for (h=0; h<8; h++)
+	{
+		if (sum->rx_rsr[h])
+			seq_printf(m, "rx_rsr_bit%d    %lu\n", h, sum->rx_rsr[h]);
+	}
+	seq_printf(m, "rx_dropped     %lu\n", sum->rx_dropped);
+	seq_printf(m, "reply_timeouts %lu\n", sum->reply_timeouts);
+	seq_printf(m, "reply_late     %lu\n", sum->reply_late);
+	seq_printf(m, "reply_errors   %lu\n", sum->reply_errors);
+	seq_printf(m, "reply_failed   %lu\n", sum->reply_failed);
+	seq_printf(m, "busy_poll_hit  %lu\n", sum->busy_poll_hit);
+	seq_printf(m, "busy_poll_miss %lu\n", sum->busy_poll_miss);
+	seq_printf(m, "irq_poll       %lu\n", sum->irq_poll);
+	seq_printf(m, "irq_poll_frames %lu\n", sum->irq_poll_frames);
+	seq_printf(m, "red_retries    %lu\n", sum->red_retries);
+	seq_printf(m, "red_failovers  %lu\n", sum->red_failovers);
+	seq_printf(m, "scan_overrun   %u\n", iobus_dev->scan_overrun);
+	seq_printf(m, "bcast_overrun  %u\n", iobus_dev->bcast_overrun);
+	for (h=0; h<IOBUS_HIST_NUM; h++)
+	{
+		seq_printf(m, "\n%s (ns)\n", hist_names[h]);
+		for (b=0; b<IOBUS_HIST_BUCKETS; b++)
+		{
+			if (sum->hist[h][b] == 0)
+				continue;
+			if (b == 0)
+				seq_printf(m, "  %10u %10u  %lu\n", 0, 1, sum->hist[h][b]);
+			else
+				seq_printf(m, "  %10u %10u  %lu\n", 1U << (b - 1), (1U << b) - 1, sum->hist[h][b]);
+		}
+	}
+	kfree(sum);
+	return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, stats_show, inode->i_private);
+}
+
+static const struct file_operations stats_fops = {
+	.owner = THIS_MODULE,
+	.open = stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+  * @brief  debugfs的regs文件，输出控制寄存器镜像及可安全读取的状态寄存器
+  *         RTER不做镜像，只输出硬件值；ISR读清零，不在此读取
+  */
+static const struct {
+	const char *name;
+	int addr;
+} ctrl_regs[] = {
+	{ "TCR", TCR }, { "TNUMR_L", TNUMR_L }, { "TNUMR_H", TNUMR_H }, { "RPAR", RPAR },
+	{ "RPAMR1", RPAMR1 }, { "IMR", IMR }, { "CHSEL", CHSEL },
+	{ "RUNSTAT", RUNSTAT }, { "RXTXEN", RXTXEN }, { "LED", LED },
+};
+
+static int regs_show(struct seq_file *m, void *v)
+{
+	int i = 0;
+	unsigned char mirror[ARRAY_SIZE(ctrl_regs)];
+	unsigned char rter = 0, rsr = 0, rdn1 = 0, rdn2 = 0;
+	IOBUS_DEV *iobus_dev = (IOBUS_DEV *)m->private;
+	spin_lock_irq(&iobus_dev->spinlock);
+	for (i=0; i<ARRAY_SIZE(ctrl_regs); i++)
+		mirror[i] = ctrl_reg(iobus_dev, ctrl_regs[i].addr);
+	rter = read_cpld(iobus_dev, RTER);
+	rsr = read_cpld(iobus_dev, RSR);
+	rdn1 = read_cpld(iobus_dev, RDN1);
+	rdn2 = read_cpld(iobus_dev, RDN2);
+	spin_unlock_irq(&iobus_dev->spinlock);
+	seq_printf(m, "mirror\n");
+	for (i=0; i<ARRAY_SIZE(ctrl_regs); i++)
+		seq_printf(m, "  %-8s 0x%03x  0x%02x\n", ctrl_regs[i].name, ctrl_regs[i].addr, mirror[i]);
+	seq_printf(m, "hardware\n");
+	seq_printf(m, "  %-8s 0x%03x  0x%02x\n", "RTER", RTER, rter);
+	seq_printf(m, "  %-8s 0x%03x  0x%02x\n", "RSR", RSR, rsr);
+	seq_printf(m, "  %-8s 0x%03x  0x%02x\n", "RDN1", RDN1, rdn1);
+	seq_printf(m, "  %-8s 0x%03x  0x%02x\n", "RDN2", RDN2, rdn2);
+	return 0;
+}
+
+static int regs_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, regs_show, inode->i_private);
+}
+
+static const struct file_operations regs_fops = {
+	.owner = THIS_MODULE,
+	.open = regs_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+  * @brief  创建debugfs目录，失败时只告警，不影响驱动工作
+  */
+static void iobus_debugfs_init(IOBUS_DEV *iobus_dev)
+{
+	iobus_dev->debugfs_dir = debugfs_create_dir(iobus_dev->name, NULL);
+	if (IS_ERR_OR_NULL(iobus_dev->debugfs_dir))
+	{
+		printk(KERN_WARNING "iobus: can't create debugfs directory\n");
+		iobus_dev->debugfs_dir = NULL;
+		return;
+	}
+	debugfs_create_file("bench", S_IRUSR | S_IWUSR, iobus_dev->debugfs_dir, iobus_dev, &bench_fops);
+	debugfs_create_file("stats", S_IRUGO, iobus_dev->debugfs_dir, iobus_dev, &stats_fops);
+	debugfs_create_file("regs", S_IRUSR, iobus_dev->debugfs_dir, iobus_dev, &regs_fops);
+}
+
+static void iobus_debugfs_exit(IOBUS_DEV *iobus_dev)
+{
+	debugfs_remove_recursive(iobus_dev->debugfs_dir);
+}
+
 static struct file_operations fops = {
 	.open = iobus_open,
 	.release = iobus_close,
 	.write = iobus_write,
 	.read = iobus_read,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 11, 0)
+	.aio_read = iobus_aio_read,
+	.aio_write = iobus_aio_write,
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+	.read_iter = iobus_read_iter,
+	.write_iter = iobus_write_iter,
+#endif
 	.poll = iobus_poll,
-	.ioctl = iobus_ioctl,
+	.mmap = iobus_mmap,
+	.unlocked_ioctl = iobus_ioctl,
 };
 
-static int __init iobus_init(void)
+/**
+  * @brief  创建一个CPLD总线控制器实例
+  *         各实例的锁、中断、队列、统计和内核线程相互独立，不同总线上的通信互不影响
+  */
+static IOBUS_DEV *iobus_dev_create(int index)
 {
 	int ret = 0;
 	struct device *device = NULL;
+	IOBUS_DEV *iobus_dev = NULL;
 	/* 为自定义设备结构分配空间 */ 
-	iobus_dev_glb = kmalloc(sizeof(IOBUS_DEV), GFP_KERNEL);
-	if (iobus_dev_glb == NULL)
+	iobus_dev = kzalloc(sizeof(IOBUS_DEV), GFP_KERNEL);
+	if (iobus_dev == NULL)
 	{
 		printk(KERN_ERR "can't allocate memory for device");
-		return -1;
+		return ERR_PTR(-ENOMEM);
 	}
-	/* 分配字符设备号并且初始化字符设备 */
-	ret = alloc_chrdev_region(&devno, 0, 1, DEV_NAME);
-	if (ret) 
+	iobus_dev->index = index;
+	snprintf(iobus_dev->name, sizeof(iobus_dev->name), DEV_NAME "%d", index);
+	iobus_dev->bus_ops = iobus_bus_ops;
+	iobus_dev->frame_max = frame_max;
+	ret = shm_init(iobus_dev, rx_ring_depth, tx_ring_depth);
+	if (ret)
 	{
-		printk(KERN_ERR "can't allocate device number!\n");
-		goto alloc_chrdev_region_err;		
+		printk(KERN_ERR "can't allocate memory for rings!\n");
+		goto shm_init_err;
+	}
+	iobus_dev->stats = alloc_percpu(IOBUS_STATS);
+	if (iobus_dev->stats == NULL)
+	{
+		printk(KERN_ERR "can't allocate memory for statistics!\n");
+		ret = -ENOMEM;
+		goto stats_alloc_err;
+	}
+	spin_lock_init(&iobus_dev->spinlock);
+	spin_lock_init(&iobus_dev->bus_lock);
+	init_waitqueue_head(&iobus_dev->send_wq);
+	init_waitqueue_head(&iobus_dev->recv_wq);
+	init_waitqueue_head(&iobus_dev->xact_wq);
+	iobus_dev->irq_isr = 0;
+	iobus_dev->irq_rsr = 0;
+	iobus_dev->irq_masked = false;
+	INIT_LIST_HEAD(&iobus_dev->rx_filters);
+	mutex_init(&iobus_dev->send_mutex);
+	mutex_init(&iobus_dev->recv_mutex);
+	mutex_init(&iobus_dev->xact_mutex);
+	mutex_init(&iobus_dev->process_mutex);
+	iobus_dev->busy_poll_us = 0;
+	iobus_dev->coalesce_budget = 0;
+	iobus_dev->coalesce_idle_us = 0;
+	iobus_hrtimer_init(&iobus_dev->reply_timer, reply_timeout_func);
+	iobus_dev->reply_seq = 0;
+	iobus_dev->red_enable = false;
+	iobus_dev->rx_err_report = false;
+	iobus_dev->red_retry = false;
+	iobus_dev->err_retry = false;
+	iobus_dev->tx_staged = false;
+	iobus_dev->tx_filling = false;
+	iobus_hrtimer_init(&iobus_dev->scan_timer, scan_timer_func);
+	iobus_dev->scan_tab = NULL;
+	iobus_dev->scan_count = 0;
+	iobus_dev->scan_index = 0;
+	iobus_dev->scan_cycle = 0;
+	iobus_dev->scan_overrun = 0;
+	iobus_dev->scan_running = false;
+	iobus_hrtimer_init(&iobus_dev->bcast_timer, bcast_timer_func);
+	iobus_dev->bcast_tab = NULL;
+	iobus_dev->bcast_count = 0;
+	iobus_dev->bcast_overrun = 0;
+	/* 按卡件地址索引的扫描结果表 */
+	iobus_dev->slots = vmalloc_user(IOBUS_SLOT_NUM * sizeof(IOBUS_SLOT));
+	if (iobus_dev->slots == NULL)
+	{
+		printk(KERN_ERR "can't allocate memory for scan slots!\n");
+		ret = -ENOMEM;
+		goto slots_alloc_err;
 	}
-	cdev_init(&iobus_dev_glb->cdev, &fops);
-	iobus_dev_glb->cdev.owner = THIS_MODULE;
-	ret = cdev_add(&iobus_dev_glb->cdev, devno, 1);
+	iobus_dev->irq_hold_min = 0;
+	iobus_dev->irq_hold_max = 0;
+	iobus_dev->irq_hold_sum = 0;
+	iobus_dev->irq_hold_count = 0;
+	mutex_init(&iobus_dev->bench_mutex);
+	iobus_dev->bench_result_len = 0;
+	iobus_dev->bench_result = kmalloc(IOBUS_BENCH_RESULT_SIZE, GFP_KERNEL);
+	if (iobus_dev->bench_result == NULL)
+	{
+		printk(KERN_ERR "can't allocate memory for bench result!\n");
+		ret = -ENOMEM;
+		goto bench_alloc_err;
+	}
+	/* 总线、hdlc寄存器和中断只在模块加载时初始化一次，打开/关闭设备不再复位CPLD */
+	ret = iobus_dev->bus_ops->init(iobus_dev);
+	if (ret)
+	{
+		printk(KERN_ERR "can't initialize %s bus for %s!\n", iobus_dev->bus_ops->name, iobus_dev->name);
+		goto bus_init_err;
+	}
+	iobus_dev->bus_ops->setup(iobus_dev);
+	hdlc_init(iobus_dev);
+	ret = iobus_dev->bus_ops->irq_request(iobus_dev);
+	if (ret)
+		goto irq_request_err;
+	/* 引擎线程会访问总线，在总线和中断之后创建、之前停止 */
+	iobus_dev->engine_events = 0;
+	iobus_dev->engine_task = kthread_run(engine_thread, iobus_dev, "iobus_engine%d", index);
+	if (IS_ERR(iobus_dev->engine_task))
+	{
+		printk(KERN_ERR "can't create engine thread!\n");
+		ret = PTR_ERR(iobus_dev->engine_task);
+		goto engine_create_err;
+	}
+	/* 定时器回调在引擎线程退出后仍可能唤醒它，保留引用直到定时器全部取消 */
+	get_task_struct(iobus_dev->engine_task);
+	/* 初始化字符设备，次设备号即控制器序号 */
+	cdev_init(&iobus_dev->cdev, &fops);
+	iobus_dev->cdev.owner = THIS_MODULE;
+	ret = cdev_add(&iobus_dev->cdev, MKDEV(MAJOR(devno), index), 1);
 	if (ret) 
 	{
 		printk(KERN_ERR "can't add character device!\n");
 		goto cdev_add_err; 
 	} 
 	/* 自动创建设备节点 */
-	iobus_dev_class = class_create(iobus_dev_glb->cdev.owner, DEV_NAME);
-	if (IS_ERR(iobus_dev_class))
-	{
-		printk(KERN_ERR "can't create class node!\n");
-		ret = PTR_ERR(iobus_dev_class);
-		goto class_create_err;
-	}
-	device = device_create(iobus_dev_class, NULL, devno, NULL, DEV_NAME);
+	device = device_create(iobus_dev_class, NULL, MKDEV(MAJOR(devno), index), NULL, "%s", iobus_dev->name);
 	if (IS_ERR(device))
 	{
 		printk(KERN_ERR "can't create device node!\n");
 		ret = PTR_ERR(device);
 		goto device_create_err;
 	}
-	/* 映射寄存器地址到内核虚拟空间 */
-	iobus_dev_glb->iomux_regs = ioremap(IOMUX_BASE, IOMUX_MEM_SIZE);
-	if (iobus_dev_glb->iomux_regs == NULL) 
+	printk(KERN_INFO "%s: using %s bus, %u rx + %u tx frames of %u bytes, %u KiB shared\n",
+		   iobus_dev->name, iobus_dev->bus_ops->name, iobus_dev->rx_ring.mask + 1, iobus_dev->tx_ring.mask + 1,
+		   iobus_dev->rx_ring.stride, ((IOBUS_SHM_HDR *)iobus_dev->shm)->size >> 10);
+	iobus_debugfs_init(iobus_dev);
+	return iobus_dev;
+device_create_err:
+	cdev_del(&iobus_dev->cdev);
+cdev_add_err:
+	kthread_stop(iobus_dev->engine_task);
+engine_create_err:
+	iobus_dev->bus_ops->irq_free(iobus_dev);
+	hrtimer_cancel(&iobus_dev->reply_timer);
+	if (!IS_ERR(iobus_dev->engine_task))
+		put_task_struct(iobus_dev->engine_task);
+irq_request_err:
+	iobus_dev->bus_ops->exit(iobus_dev);
+bus_init_err:
+	kfree(iobus_dev->bench_result);
+bench_alloc_err:
+	vfree(iobus_dev->slots);
+slots_alloc_err:
+	free_percpu(iobus_dev->stats);
+stats_alloc_err:
+	shm_free(iobus_dev);
+shm_init_err:
+	kfree(iobus_dev);
+	return ERR_PTR(ret);
+}
+
+static void iobus_dev_destroy(IOBUS_DEV *iobus_dev)
+{
+	iobus_debugfs_exit(iobus_dev);
+	device_destroy(iobus_dev_class, MKDEV(MAJOR(devno), iobus_dev->index));
+	cdev_del(&iobus_dev->cdev);
+	/* 停止扫描和广播后先停引擎线程、释放中断，两者都会重新启动等待返回的定时器，
+	 * 之后才能取消定时器并释放总线 */
+	iobus_scan_stop(iobus_dev);
+	spin_lock_irq(&iobus_dev->spinlock);
+	iobus_dev->bcast_count = 0;
+	spin_unlock_irq(&iobus_dev->spinlock);
+	kthread_stop(iobus_dev->engine_task);
+	iobus_dev->bus_ops->irq_free(iobus_dev);
+	hrtimer_cancel(&iobus_dev->reply_timer);
+	hrtimer_cancel(&iobus_dev->bcast_timer);
+	hrtimer_cancel(&iobus_dev->scan_timer);
+	put_task_struct(iobus_dev->engine_task);
+	iobus_dev->bus_ops->exit(iobus_dev);
+	vfree(iobus_dev->scan_tab);
+	vfree(iobus_dev->bcast_tab);
+	kfree(iobus_dev->bench_result);
+	vfree(iobus_dev->slots);
+	free_percpu(iobus_dev->stats);
+	shm_free(iobus_dev);
+	kfree(iobus_dev);
+}
+
+static int __init iobus_init(void)
+{
+	int ret = 0;
+	int i = 0;
+	IOBUS_DEV *iobus_dev = NULL;
+	if (devices == 0 || devices > IOBUS_MAX_DEVS)
 	{
-		printk(KERN_ERR "can't remap IOMUX memory to virtual address!\n");
-		ret = -1;
-		goto ioremap_iomux_err;
+		printk(KERN_ERR "iobus: devices must be 1..%d!\n", IOBUS_MAX_DEVS);
+		return -EINVAL;
+	}
+	if (frame_max == 0 || frame_max > IOBUS_FRAME_MAX)
+	{
+		printk(KERN_ERR "iobus: frame_max must be 1..%d!\n", IOBUS_FRAME_MAX);
+		return -EINVAL;
+	}
+	/* 管脚表在任何后端下都检查，新底板的定义可先在主机上用sim后端验证 */
+	ret = board_check();
+	if (ret)
+		return ret;
+	/* 选择总线后端，所有实例使用同一后端 */
+	if (strcmp(bus, "sim") == 0)
+		iobus_bus_ops = &sim_bus_ops;
+	else if (strcmp(bus, "gpio") == 0)
+		iobus_bus_ops = &gpio_bus_ops;
+	else
+	{
+		printk(KERN_ERR "unknown bus backend %s!\n", bus);
+		return -EINVAL;
 	}
-	iobus_dev_glb->gpio4_regs = ioremap(GPIO4_BASE, GPIO4_MEM_SIZE);
-	if (iobus_dev_glb->gpio4_regs == NULL)
+	/* 分配字符设备号，每个控制器一个次设备号 */
+	ret = alloc_chrdev_region(&devno, 0, devices, DEV_NAME);
+	if (ret) 
 	{
-		printk(KERN_ERR "can't remap GPIO4 memory to virtual address!\n");
-		ret = -1;
-		goto ioremap_gpio4_err;
+		printk(KERN_ERR "can't allocate device number!\n");
+		return ret;
 	}
-	iobus_dev_glb->gpio3_regs = ioremap(GPIO3_BASE, GPIO3_MEM_SIZE);
-	if (iobus_dev_glb->gpio3_regs == NULL)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	iobus_dev_class = class_create(DEV_NAME);
+#else
+	iobus_dev_class = class_create(THIS_MODULE, DEV_NAME);
+#endif
+	if (IS_ERR(iobus_dev_class))
 	{
-		printk(KERN_ERR "can't remap GPIO3 memory to virtual address!\n");
-		ret = -1;
-		goto ioremap_gpio3_err;
+		printk(KERN_ERR "can't create class node!\n");
+		ret = PTR_ERR(iobus_dev_class);
+		goto class_create_err;
 	}
-	iobus_dev_glb->gpio1_regs = ioremap(GPIO1_BASE, GPIO1_MEM_SIZE);
-	if (iobus_dev_glb->gpio1_regs == NULL)
+	for (i=0; i<devices; i++)
 	{
-		printk(KERN_ERR "can't remap GPIO3 memory to virtual address!\n");
-		ret = -1;
-		goto ioremap_gpio1_err;
+		iobus_dev = iobus_dev_create(i);
+		if (IS_ERR(iobus_dev))
+		{
+			ret = PTR_ERR(iobus_dev);
+			goto dev_create_err;
+		}
+		iobus_devs[i] = iobus_dev;
 	}
 	return 0;
-ioremap_gpio1_err:
-	iounmap(iobus_dev_glb->gpio3_regs);
-ioremap_gpio3_err:
-	iounmap(iobus_dev_glb->gpio4_regs);
-ioremap_gpio4_err:
-	iounmap(iobus_dev_glb->iomux_regs);
-ioremap_iomux_err:
-	device_destroy(iobus_dev_class, devno);
-device_create_err:
+dev_create_err:
+	while (i-- > 0)
+	{
+		iobus_dev_destroy(iobus_devs[i]);
+		iobus_devs[i] = NULL;
+	}
 	class_destroy(iobus_dev_class);
 class_create_err:
-	cdev_del(&iobus_dev_glb->cdev);
-cdev_add_err:
-	unregister_chrdev_region(devno, 1);
-alloc_chrdev_region_err:
-	kfree(iobus_dev_glb);
+	unregister_chrdev_region(devno, devices);
 	return ret;
 }
 
 static void __exit iobus_exit(void)
 {
-	iounmap(iobus_dev_glb->gpio1_regs);
-	iounmap(iobus_dev_glb->gpio3_regs);
-	iounmap(iobus_dev_glb->gpio4_regs);
-	iounmap(iobus_dev_glb->iomux_regs);
-	device_destroy(iobus_dev_class, devno);
+	int i = devices;
+	while (i-- > 0)
+		iobus_dev_destroy(iobus_devs[i]);
 	class_destroy(iobus_dev_class);
-	cdev_del(&iobus_dev_glb->cdev);
-	unregister_chrdev_region(devno, 1);
-	kfree(iobus_dev_glb);
+	unregister_chrdev_region(devno, devices);
 }
 
 module_init(iobus_init);
@@ -5,29 +5,264 @@
 #include <linux/spinlock.h>
 #include <linux/interrupt.h>
 #include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include "iobus_ioctl.h"
+#include "iobus_board.h"
+
+#define IOBUS_RX_RING_DEPTH		16		//接收环形队列默认深度(帧)
+#define IOBUS_TX_RING_DEPTH		16		//发送环形队列默认深度(帧)
+#define IOBUS_MAX_DEVS			4		//每个节点最多的CPLD总线控制器数，每个对应一个/dev/iobusN
+
+/* 队列中一帧占用的空间：帧描述符头加frame_max字节数据，按缓存行对齐，相邻帧不共享缓存行 */
+#define IOBUS_FRAME_STRIDE(frame_max)	ALIGN(offsetof(IOBUS_FRAME, data) + (frame_max), IOBUS_CACHELINE)
+
+/* 单生产者/单消费者无锁环形队列，控制块位于共享区中 */
+typedef struct {
+	IOBUS_RING_CTL *ctl;
+	unsigned int mask;			//深度-1
+	unsigned int stride;		//帧间距，IOBUS_FRAME_STRIDE
+	unsigned char *frames;		//帧数组，按stride访问，不能当作IOBUS_FRAME数组下标
+}IOBUS_RING;
+
+/* 驱动内的周期广播状态，帧在设置时一次构造好 */
+typedef struct {
+	s64 period_ns;
+	s64 next_ns;				//下一次到期时刻，CLOCK_MONOTONIC
+	bool pending;				//已到期，等待总线空闲后发送
+	IOBUS_FRAME frame;
+}IOBUS_BCAST;
+
+struct iobus_dev;
+
+/* 延迟直方图，按log2分桶，第b桶统计[2^(b-1), 2^b)ns，第0桶为0ns */
+#define IOBUS_HIST_BUCKETS		32
+#define IOBUS_HIST_IRQ_WAKE		0	//中断顶半部入口到唤醒等待者
+#define IOBUS_HIST_TX_DONE		1	//帧入发送队列到发送完成中断
+#define IOBUS_HIST_REPLY		2	//启动发送到收到卡件返回
+#define IOBUS_HIST_NUM			3
+
+/* 统计计数，每CPU一份，读取时求和 */
+typedef struct {
+	unsigned long irq;			//中断次数
+	unsigned long tx_frames;	//发送完成帧数
+	unsigned long tx_bytes;
+	unsigned long tx_eagain;	//非阻塞写时发送队列满
+	unsigned long tx_invalid;	//mmap发送队列中长度非法被丢弃的帧
+	unsigned long rx_frames;	//接收帧数，包括事务和扫描的返回
+	unsigned long rx_bytes;
+	unsigned long rx_errors;	//RSR非0被丢弃的帧
+	unsigned long rx_truncated;	//长度超过frame_max被截断的帧
+	unsigned long rx_rsr[8];	//按RSR各位统计的接收错误
+	unsigned long reply_errors;	//等待返回期间收到出错的帧
+	unsigned long reply_failed;	//出错重发后仍收到出错的帧，等待以失败结束
+	unsigned long rx_dropped;	//接收队列满被丢弃的帧
+	unsigned long reply_timeouts;	//等待卡件返回超时
+	unsigned long reply_late;	//超时后才到达被丢弃的返回帧
+	unsigned long busy_poll_hit;	//忙轮询期间等到结果
+	unsigned long busy_poll_miss;	//忙轮询超时，转为睡眠等待
+	unsigned long irq_poll;		//中断合并的轮询次数
+	unsigned long irq_poll_frames;	//中断屏蔽期间轮询收到的帧数
+	unsigned long red_retries;	//冗余模式下超时后换通道重发
+	unsigned long red_failovers;	//重发收到返回，主备通道互换
+	unsigned long hist[IOBUS_HIST_NUM][IOBUS_HIST_BUCKETS];
+}IOBUS_STATS;
+
+/* 总线后端操作表，GPIO模拟总线与仿真CPLD各一份 */
 typedef struct {
+	const char *name;
+	int (*init)(struct iobus_dev *iobus_dev);		//模块加载时调用
+	void (*exit)(struct iobus_dev *iobus_dev);		//模块卸载时调用
+	void (*setup)(struct iobus_dev *iobus_dev);		//模块加载时在init之后调用，配置管脚并使总线空闲
+	void (*write)(struct iobus_dev *iobus_dev, int addr, unsigned char data);
+	unsigned char (*read)(struct iobus_dev *iobus_dev, int addr);
+	void (*write_burst)(struct iobus_dev *iobus_dev, int addr, const unsigned char *buf, int len);
+	void (*read_burst)(struct iobus_dev *iobus_dev, int addr, unsigned char *buf, int len);
+	int (*irq_request)(struct iobus_dev *iobus_dev);	//以hdlc_interrupt_handler/hdlc_irq_thread接入中断
+	void (*irq_free)(struct iobus_dev *iobus_dev);
+	void (*irq_mask)(struct iobus_dev *iobus_dev);		//可在中断顶半部调用
+	void (*irq_unmask)(struct iobus_dev *iobus_dev);	//调用者需持有spinlock
+}IOBUS_BUS_OPS;
+
+#define CPLD_ADDR_SPACE			BUS_ADDR_SPACE	//CPLD地址空间，由板上译码的地址线数决定，仿真后端按同一边界回绕
+#define CPLD_CTRL_BASE			0x100	//CPLD寄存器起始地址
+#define CPLD_CTRL_NUM			0x30	//寄存器镜像覆盖TCR~LED
+
+/* 仿真CPLD状态 */
+typedef struct {
+	struct iobus_dev *iobus_dev;
+	unsigned char regs[CPLD_ADDR_SPACE];	//寄存器文件，按CPLD地址索引
+	unsigned char tx_ram[IOBUS_FRAME_MAX];	//发送双口RAM
+	unsigned char rx_ram[IOBUS_FRAME_MAX];	//接收双口RAM
+	unsigned char reply[IOBUS_FRAME_MAX];	//卡件正在返回的帧
+	unsigned short tx_len;
+	unsigned short reply_len;
+	unsigned char isr;						//中断状态，读清零
+	bool irq_pending;
+	bool irq_masked;
+	struct hrtimer tx_timer;				//发送完成时刻
+	struct hrtimer rx_timer;				//返回帧接收完成时刻
+	struct task_struct *irq_task;			//模拟中断
+}IOBUS_SIM;
+
+typedef struct iobus_dev {
 	struct cdev cdev;
+	int index;					//控制器序号，即次设备号
+	char name[16];				//iobusN，用于设备节点、中断、内核线程和debugfs目录
+	const IOBUS_BUS_OPS *bus_ops;	//总线后端
+	unsigned int frame_max;		//最大帧长，不超过CPLD双口RAM容量IOBUS_FRAME_MAX
+	IOBUS_SIM *sim;				//仿真CPLD，仅sim后端使用
+	int irq;					//中断号，sim后端为-1
 	void __iomem *iomux_regs;
-	void __iomem *gpio4_regs;
-	void __iomem *gpio3_regs;
-	void __iomem *gpio1_regs;
-	void __iomem *gpio7_regs;
-	unsigned char recv_buf[256];
-	unsigned char send_buf[256];
-	bool send_stat;
-	bool recv_stat;
-	int recv_bytes;
+	/* 按用途映射的GPIO组，见iobus_board.h */
+	void __iomem *addr_regs;
+	void __iomem *data_regs;
+	void __iomem *ctl_regs;
+	void __iomem *irq_regs;
+	/* GPIO数据/方向寄存器影子值，避免总线时序中的读-改-写 */
+	unsigned int ctl_dr;
+	unsigned int data_dr;
+	unsigned int data_gdir;
+	unsigned int addr_dr;
+	/* 由本实例管脚表算出的掩码和移位，gpio_bus_init()中设置 */
+	const IOBUS_BOARD_BUS *board;
+	unsigned int addr_msk;
+	unsigned int data_msk;
+	unsigned int bus_wr;
+	unsigned int bus_rd;
+	unsigned char addr_shift;
+	unsigned char data_shift;
+	void *shm;					//可mmap到用户态的共享区，存放收发队列
+	IOBUS_RING rx_ring;			//接收帧队列，中断线程生产，iobus_read或mmap用户消费
+	IOBUS_RING tx_ring;			//发送帧队列，iobus_write或mmap用户生产，持锁调用hdlc_start_tx消费
+	atomic_t mmap_count;		//共享区被映射的次数，映射期间不能read/write
+	bool send_stat;				//CPLD发送双口RAM是否有帧正在发送
+	unsigned char irq_isr;		//中断顶半部锁存的ISR
+	unsigned char irq_rsr;		//中断顶半部锁存的RSR
 	wait_queue_head_t send_wq;
 	wait_queue_head_t recv_wq;
-	struct tasklet_struct recv_tasklet;
-	spinlock_t spinlock;
+	spinlock_t spinlock;		//收发状态、队列控制和控制寄存器镜像，持有期间不做双口RAM的整块访问
+	spinlock_t bus_lock;		//总线周期锁，只在一次寄存器访问或一块双口RAM访问期间持有，保护GPIO影子寄存器和仿真CPLD，在spinlock之内获取
+	struct mutex process_mutex;	//中断线程与忙轮询互斥处理锁存的中断状态
+	unsigned int busy_poll_us;	//忙轮询时间，0表示不轮询
+	unsigned int coalesce_budget;	//中断合并：一次轮询最多处理的收发完成事件数，0表示不合并
+	unsigned int coalesce_idle_us;	//中断合并：总线空闲超过该时间结束轮询
+	bool irq_masked;			//中断已屏蔽，由中断线程轮询
+	struct mutex send_mutex;	//串行化多个写者对tx_ring的生产
+	struct mutex recv_mutex;	//串行化多个读者对rx_ring的消费
+	struct list_head rx_filters;	//设置了接收过滤的文件，按设置顺序匹配
+	unsigned char ctrl_mirror[CPLD_CTRL_NUM];	//CPLD控制寄存器镜像，按地址-CPLD_CTRL_BASE索引
+	bool rx_draining;			//中断线程正在读取接收双口RAM
+	/* 等待卡件返回，同一时刻总线上最多一个 */
+	int reply_owner;			//REPLY_*
+	unsigned int reply_seq;		//等待序号，用于识别迟到的返回帧和过时的超时
+	unsigned int timeout_seq;	//超时定时器到期时的等待序号
+	unsigned int armed_seq;		//超时定时器启动时的等待序号，帧发出前reply_seq已指向下一次等待
+	struct hrtimer reply_timer;
+	ktime_t reply_timeout;		//本次等待的超时时间，冗余重发时沿用
+	/* 冗余通道，spinlock保护 */
+	bool red_enable;
+	bool red_retry;				//本次等待是换通道后的重发
+	bool err_retry;				//本次等待是返回帧出错后的重发
+	bool rx_err_report;			//出错帧以len为0的描述符进入接收队列
+	unsigned char red_chan[2];	//[0]首发通道，[1]超时后重发的通道，CHSEL值
+	/* 请求/应答事务 */
+	struct mutex xact_mutex;	//同一时刻只允许一个事务
+	int xact_state;				//XACT_*
+	ktime_t xact_timeout;
+	wait_queue_head_t xact_wq;
+	IOBUS_FRAME xact_tx;		//事务发送帧
+	IOBUS_FRAME xact_rx;		//事务返回帧
+	/* 周期扫描 */
+	IOBUS_SCAN_ENTRY *scan_tab;	//扫描表
+	unsigned int scan_count;	//扫描表项数
+	unsigned int scan_index;	//本轮下一个要发送的表项，等于scan_count表示本轮已完成
+	unsigned int scan_cycle;	//扫描轮数
+	unsigned int scan_overrun;	//因上一轮未完成而跳过的轮数
+	bool scan_running;
+	ktime_t scan_period;
+	struct hrtimer scan_timer;
+	IOBUS_FRAME scan_tx;		//扫描发送帧
+	IOBUS_FRAME scan_rx;		//扫描返回帧
+	IOBUS_BCAST *bcast_tab;		//周期广播表，spinlock保护
+	unsigned int bcast_count;
+	unsigned int bcast_overrun;	//上一次未发出又再次到期的次数
+	struct hrtimer bcast_timer;	//最早到期的广播帧
+	IOBUS_SLOT *slots;			//按卡件地址索引的扫描结果表
+	/* 总线引擎线程，处理超时和扫描周期 */
+	struct task_struct *engine_task;
+	unsigned long engine_events;	//ENGINE_EV_*
+	/* 统计 */
+	IOBUS_STATS __percpu *stats;
+	ktime_t irq_entry;			//最近一次中断顶半部入口时间
+	ktime_t rmc_stamp;			//锁存接收完成时读ISR之前的时刻
+	ktime_t tmc_stamp;			//锁存发送完成时读ISR之前的时刻
+	/* 发送分两步：持spinlock选出下一帧拷入tx_stage并占用发送双口RAM，不持spinlock写入双口RAM后再持锁启动 */
+	IOBUS_FRAME tx_stage;		//待写入发送双口RAM的帧
+	bool tx_staged;				//tx_stage中有帧等待写入并启动
+	bool tx_filling;			//有线程正在把tx_stage写入双口RAM
+	int tx_stage_owner;			//REPLY_*，需要等待返回时启动发送后才开始计时
+	unsigned int tx_stage_seq;	//对应的等待序号，写入期间等待被取消时不再启动
+	ktime_t tx_start;			//当前帧启动发送的时间
+	__u64 tx_enqueue_ns;		//当前帧入发送队列的时间，0表示未知
+	unsigned short tx_len;		//当前帧长度
+	/* 中断顶半部持锁时间，单位ns，由debugfs的bench文件读出后清零 */
+	unsigned int irq_hold_min;
+	unsigned int irq_hold_max;
+	unsigned long long irq_hold_sum;
+	unsigned int irq_hold_count;
+	/* debugfs总线测速 */
+	struct dentry *debugfs_dir;
+	struct mutex bench_mutex;
+	char *bench_result;			//最近一次测速结果文本
+	size_t bench_result_len;
 }IOBUS_DEV;
 
+/* 每个打开文件的状态 */
+typedef struct {
+	IOBUS_DEV *iobus_dev;
+	int mode;					//读写格式 IOBUS_MODE_*
+	/* 接收地址过滤，设置后匹配的帧只进入本文件的接收队列 */
+	struct list_head filter_node;	//挂在rx_filters上，spinlock保护
+	bool filtered;
+	__u8 filter_addr;
+	__u8 filter_mask;
+	void *rx_buf;				//私有接收队列的控制块和帧数组
+	IOBUS_RING filter_ring;
+	wait_queue_head_t filter_wq;
+	struct mutex filter_mutex;	//私有接收队列的消费者互斥
+	/* 本文件read/poll使用的接收队列，未设置过滤时指向设备的共享队列 */
+	IOBUS_RING *rx_ring;
+	wait_queue_head_t *recv_wq;
+	struct mutex *recv_mutex;
+}IOBUS_FILE;
+
+/* 等待返回的发起者 */
+#define REPLY_NONE				0
+#define REPLY_XACT				1	//IOBUS_IOC_TRANSACT事务
+#define REPLY_SCAN				2	//扫描表项
+
+/* 总线引擎线程事件位 */
+#define ENGINE_EV_TIMEOUT		0	//等待返回超时
+#define ENGINE_EV_SCAN			1	//扫描周期开始
+#define ENGINE_EV_BCAST			2	//周期广播到期
+
+/* 事务状态 */
+#define XACT_IDLE				0
+#define XACT_PENDING			1	//等待总线空闲后发送
+#define XACT_SENT				2	//已启动发送，等待返回(reply_owner为REPLY_XACT)
+#define XACT_DONE				3	//已收到返回
+#define XACT_TIMEOUT			4	//等待返回超时
+
 #define DEV_NAME				"iobus"
-#define CPLD_ADDR_SHIFT			6
-#define CPLD_DATA_SHIFT			16
 #define IDLE					false
 #define BUSY					true
+#define IOBUS_COALESCE_MAX_POLL_US	2000	//中断合并：一次轮询的总时间上限，持续的收发完成不能让中断一直屏蔽
+#define IOBUS_DRAIN_CHUNK		32		//每次持bus_lock读写双口RAM的字节数
+#define IOBUS_BENCH_MAX_ITERS	100000	//总线测速最大迭代次数
+#define IOBUS_BENCH_RESULT_SIZE	1024	//测速结果文本缓存大小
 /* IOMUX */
 #define IOMUX_MEM_SIZE			0x3FFF
 #define IOMUX_BASE				0x53FA8000
@@ -56,37 +291,14 @@ typedef struct {
 #define IOMUX_MOD_GPIO			0x1
 #define IOMUX_MOD_MSK			0x7
 
-/* GPIO3 */
-#define GPIO3_MEM_SIZE			0x3FFF
-#define GPIO3_BASE				0x53F8C000
-#define GPIO3_DR				0
-#define GPIO3_GDIR				0x4
-
-#define GPIO3_DATA_MSK			0xFF00FFFF
-/* GPIO4 */
-#define GPIO4_MEM_SIZE			0x3FFF
-#define GPIO4_BASE				0x53F90000
-#define GPIO4_DR				0
-#define GPIO4_GDIR				0x4
-#define GPIO4_ICR1				0xC
-#define GPIO4_ICR15_RISING		0x80000000
-#define GPIO4_IMR				0x14
-#define GPIO4_IMR15_ENABLE		0x8000
-#define GPIO4_ISR				0x18 
-#define GPIO4_DIR_ADDR_OUT		0x7FC0
-#define GPIO4_ADDR_MSK			0xFFFF803F
-#define GPIO4_15				(32*3+15)
-/* GPIO1 */
-#define GPIO1_MEM_SIZE			0x3FFF
-#define GPIO1_BASE				0x53F84000
-#define GPIO1_DR				0
-#define GPIO1_GDIR				0x4
-
-#define GPIO1_DIR_RDWR_OUT		0x3
-#define GPIO1_SET_WR			0x1
-#define GPIO1_CLR_WR			0xFFFFFFFE
-#define GPIO1_SET_RD			0x2
-#define GPIO1_CLR_RD			0xFFFFFFFD
+/* GPIO组寄存器，各组相同 */
+#define GPIO_MEM_SIZE			0x3FFF
+#define GPIO_DR					0
+#define GPIO_GDIR				0x4
+#define GPIO_ICR1				0xC		//管脚0~15中断触发方式
+#define GPIO_ICR2				0x10	//管脚16~31中断触发方式
+#define GPIO_IMR				0x14
+#define GPIO_ISR				0x18
 
 /* CPLD REGISTERS */
 #define TCR						0x100	//发送控制寄存器 控制发送状态 如帧间隔 前导码等 
@@ -109,23 +321,17 @@ typedef struct {
 #define TMC						0x40	//发送完成
 #define RMC						0x1		//接收完成
 #define CHSEL					0x12C	//通道选择
-#define CH1SEL					0x1		//选择通道1
-#define CH2SEL					0		//选择通道2
-#define CHALLSEL				0x2		//双通道输出，单通道输入
+#define CH1SEL					IOBUS_CHAN_1	//选择通道1
+#define CH2SEL					IOBUS_CHAN_2	//选择通道2
+#define CHALLSEL				IOBUS_CHAN_ALL	//双通道输出，单通道输入
 #define RUNSTAT					0x12D	//主从设置
-#define RUNSTAT_M				0x1		//主模式,发送时钟
-#define RUNSTAT_S				0		//从模式,接收时钟
+#define RUNSTAT_M				IOBUS_RUN_MASTER	//主模式,发送时钟
+#define RUNSTAT_S				IOBUS_RUN_SLAVE	//从模式,接收时钟
 #define RXTXEN					0x12E	//发送接收使能	
 #define RXTXEN_R				0		//使能RS485芯片接收
 #define RXTXEN_T				0x1		//使能RS485芯片发送		
 #define LED						0x12F
 
-#define IOBUS_IOC_MAGIC				'w'
-#define IOBUS_IOC_RUN_STAT			_IOW(IOBUS_IOC_MAGIC, 1, int)	//设置主从
-#define IOBUS_IOC_CH_SEL			_IOW(IOBUS_IOC_MAGIC, 2, int) //通道选择
-#define IOBUS_IOC_LED_STAT			_IOW(IOBUS_IOC_MAGIC, 3, int)
-#define IOBUS_IOC_MAXNR				4
-
 static void set_wr(IOBUS_DEV *iobus);
 static void clr_wr(IOBUS_DEV *iobus);
 static void set_rd(IOBUS_DEV *iobus);
@@ -135,9 +341,32 @@ static void set_data_out(IOBUS_DEV *iobus_dev);
 static void set_addr(IOBUS_DEV *iobus_dev, int addr);
 static void write_data(IOBUS_DEV *iobus_dev, unsigned char data);
 static unsigned char read_data(IOBUS_DEV *iobus_dev);
+static void gpio_write_cpld(IOBUS_DEV *iobus_dev, int addr, unsigned char data);
+static unsigned char gpio_read_cpld(IOBUS_DEV *iobus_dev, int addr);
+static void gpio_write_cpld_burst(IOBUS_DEV *iobus_dev, int addr, const unsigned char *buf, int len);
+static void gpio_read_cpld_burst(IOBUS_DEV *iobus_dev, int addr, unsigned char *buf, int len);
 static void write_cpld(IOBUS_DEV *iobus_dev, int addr, unsigned char data);
 static unsigned char read_cpld(IOBUS_DEV *iobus_dev, int addr);
+static void write_cpld_burst(IOBUS_DEV *iobus_dev, int addr, const unsigned char *buf, int len);
+static void read_cpld_burst(IOBUS_DEV *iobus_dev, int addr, unsigned char *buf, int len);
+static void write_ctrl(IOBUS_DEV *iobus_dev, int addr, unsigned char data);
+static void update_ctrl(IOBUS_DEV *iobus_dev, int addr, unsigned char data);
+static unsigned char ctrl_reg(IOBUS_DEV *iobus_dev, int addr);
+static int shm_init(IOBUS_DEV *iobus_dev, unsigned int rx_depth, unsigned int tx_depth);
+static void shm_free(IOBUS_DEV *iobus_dev);
+static void ring_init(IOBUS_RING *ring, IOBUS_RING_CTL *ctl, void *base, unsigned int offset, unsigned int depth, unsigned int stride);
+static void ring_reset(IOBUS_RING *ring);
+static bool ring_empty(IOBUS_RING *ring);
+static bool ring_full(IOBUS_RING *ring);
+static IOBUS_FRAME *ring_push_slot(IOBUS_RING *ring);
+static void ring_push(IOBUS_RING *ring);
+static IOBUS_FRAME *ring_pop_slot(IOBUS_RING *ring);
+static void ring_pop(IOBUS_RING *ring);
 static void gpio_init(IOBUS_DEV *iobus);
 static void hdlc_init(IOBUS_DEV *iobus);
+static void hdlc_start_tx(IOBUS_DEV *iobus_dev);
+static irqreturn_t hdlc_interrupt_handler(int irq, void *dev_id);
+static irqreturn_t hdlc_irq_thread(int irq, void *dev_id);
+static int tx_enqueue(IOBUS_DEV *iobus_dev, bool nonblock, const IOBUS_TX_HDR *hdr, const char __user *data);
 
 #endif
@@ -0,0 +1,96 @@
+/**
+  * @brief  板级管脚分配，编译时由IOBUS_BOARD_*选择，见Makefile中的IOBUS_BOARD
+  *         每块板以BOARD_BUSES给出各CPLD总线控制器的管脚表，按实例序号(/dev/iobusN)索引，
+  *         每项为地址线、数据线、读写信号和中断所在的GPIO组及起始管脚，以及这些管脚的IOMUX复用寄存器
+  *         总线时序函数使用的掩码和移位在gpio_bus_init()中由本实例的表项算出并存入IOBUS_DEV
+  *         同一控制器的地址线、数据线、读写信号须各自位于不同的GPIO组，且不能与其他控制器共用GPIO组，
+  *         各组的影子寄存器按实例独立维护，由board_check()在模块加载时检查
+  */
+#ifndef _IOBUS_BOARD_H_
+#define _IOBUS_BOARD_H_
+
+/* 新底板按其原理图另加一个#elif分支，并在Makefile中加编译目标 */
+#if defined(IOBUS_BOARD_REVA)
+
+/* 第一版底板，只接了一个CPLD控制器 */
+#define BOARD_NAME				"reva"
+#define BOARD_SIM_ONLY			0		//是否只能配合sim后端使用
+#define BOARD_BUS_NUM			1		//CPLD总线控制器数
+#define BOARD_ADDR_WIDTH		9		//地址线数，板上各控制器相同
+#define BOARD_BUSES				{ \
+	{ \
+		.addr_bank = 4, .addr_pin = 6,				/* 地址线A0~A8：gpio4_6~gpio4_14 */ \
+		.data_bank = 3, .data_pin = 16,				/* 数据线D0~D7：gpio3_16~gpio3_23 */ \
+		.ctl_bank = 1, .wr_pin = 0, .rd_pin = 1,	/* 写信号gpio1_0，读信号gpio1_1 */ \
+		.irq_bank = 4, .irq_pin = 15,				/* HDLC中断gpio4_15，上升沿 */ \
+		.iomux_pads = { \
+			IOMUX_SW_CTRL_GPIO4_6, IOMUX_SW_CTRL_GPIO4_7, IOMUX_SW_CTRL_GPIO4_8, IOMUX_SW_CTRL_GPIO4_9, \
+			IOMUX_SW_CTRL_GPIO4_10, IOMUX_SW_CTRL_GPIO4_11, IOMUX_SW_CTRL_GPIO4_12, IOMUX_SW_CTRL_GPIO4_13, \
+			IOMUX_SW_CTRL_GPIO4_14, \
+			IOMUX_SW_CTRL_GPIO3_16, IOMUX_SW_CTRL_GPIO3_17, IOMUX_SW_CTRL_GPIO3_18, IOMUX_SW_CTRL_GPIO3_19, \
+			IOMUX_SW_CTRL_GPIO3_20, IOMUX_SW_CTRL_GPIO3_21, IOMUX_SW_CTRL_GPIO3_22, IOMUX_SW_CTRL_GPIO3_23, \
+			IOMUX_SW_CTRL_GPIO1_0, IOMUX_SW_CTRL_GPIO1_1, \
+			IOMUX_SW_CTRL_GPIO4_15 }, \
+	}, \
+}
+
+#elif defined(IOBUS_BOARD_SIMDUAL)
+
+/* 双控制器仿真布局，不对应实际底板，没有IOMUX复用寄存器，gpio后端拒绝加载
+ * 用于在主机上以sim后端测试多实例，并在另一套管脚下编译和检查管脚表 */
+#define BOARD_NAME				"simdual"
+#define BOARD_SIM_ONLY			1
+#define BOARD_BUS_NUM			2
+#define BOARD_ADDR_WIDTH		9
+#define BOARD_BUSES				{ \
+	{ \
+		.addr_bank = 2, .addr_pin = 0, \
+		.data_bank = 3, .data_pin = 24, \
+		.ctl_bank = 1, .wr_pin = 30, .rd_pin = 31, \
+		.irq_bank = 7, .irq_pin = 0, \
+	}, \
+	{ \
+		.addr_bank = 5, .addr_pin = 20, \
+		.data_bank = 6, .data_pin = 8, \
+		.ctl_bank = 4, .wr_pin = 2, .rd_pin = 3, \
+		.irq_bank = 7, .irq_pin = 17, \
+	}, \
+}
+
+#else
+#error "iobus: unknown board, set IOBUS_BOARD (supported: REVA, SIMDUAL)"
+#endif
+
+#if BOARD_ADDR_WIDTH < 1 || BOARD_ADDR_WIDTH > 24
+#error "iobus: bad BOARD_ADDR_WIDTH"
+#endif
+
+/* 每个控制器的管脚数：地址线、8根数据线、读写信号和中断 */
+#define BOARD_PAD_NUM			(BOARD_ADDR_WIDTH + 8 + 2 + 1)
+
+/* 一个CPLD总线控制器的管脚 */
+typedef struct {
+	unsigned char addr_bank;	//地址线所在GPIO组及A0管脚
+	unsigned char addr_pin;
+	unsigned char data_bank;	//数据线所在GPIO组及D0管脚
+	unsigned char data_pin;
+	unsigned char ctl_bank;		//读写信号所在GPIO组
+	unsigned char wr_pin;
+	unsigned char rd_pin;
+	unsigned char irq_bank;		//中断管脚，可与总线管脚同组
+	unsigned char irq_pin;
+	unsigned short iomux_pads[BOARD_PAD_NUM];	//全部管脚的IOMUX复用寄存器偏移
+}IOBUS_BOARD_BUS;
+
+/* i.MX53 GPIO组寄存器基地址，GPIO1~4与GPIO5~7各自连续 */
+#define GPIO_BANK_NUM			7
+#define GPIO_BANK_BASE(bank)	((bank) <= 4 ? 0x53F84000 + ((bank) - 1) * 0x4000 : 0x53FDC000 + ((bank) - 5) * 0x4000)
+/* gpiolib中的GPIO编号 */
+#define GPIO_NUMBER(bank, pin)	(32 * ((bank) - 1) + (pin))
+/* 中断管脚的触发方式寄存器，每管脚2位，10为上升沿 */
+#define GPIO_ICR(pin)			((pin) < 16 ? GPIO_ICR1 : GPIO_ICR2)
+#define GPIO_ICR_RISING(pin)	(0x2U << (((pin) & 15) * 2))
+
+#define BUS_ADDR_SPACE			(1U << BOARD_ADDR_WIDTH)	//实际译码的CPLD地址空间，超出的地址回绕到低位
+
+#endif /* _IOBUS_BOARD_H_ */
@@ -0,0 +1,238 @@
+/**
+  * @brief  iobus用户态接口：ioctl命令、读写帧头和mmap共享区格式
+  *         驱动与用户态程序(见user/libiobus)共用，只依赖linux/types.h和linux/ioctl.h，
+  *         不含驱动内部结构，修改时须保持二进制兼容
+  */
+#ifndef _IOBUS_IOCTL_H_
+#define _IOBUS_IOCTL_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define IOBUS_FRAME_MAX			256		//单帧最大长度，即CPLD双口RAM容量
+#define IOBUS_CACHELINE			64		//共享区中生产者/消费者字段按缓存行隔开
+
+/* 帧描述符，同时是mmap共享区中的帧格式
+ * 共享区队列中每帧只保留data的前frame_max字节，帧间距见IOBUS_RING_CTL的stride
+ */
+typedef struct {
+	__u16 len;					//帧长度
+	__u8 rsr;					//接收状态
+	__u8 addr;					//发送：写入RPAR的卡件地址；接收：接收时RPAR中的卡件地址
+	__u8 chan;					//发送：发送通道；接收：接收时的通道选择
+	__u8 reserved;
+	__u16 flags;				//发送：IOBUS_TXF_*
+	__u64 tstamp;				//接收：接收完成中断到达时间；发送：入队时间，0表示未知；CLOCK_MONOTONIC，单位ns
+	__u8 data[IOBUS_FRAME_MAX];
+}IOBUS_FRAME;
+
+/* mmap共享区中的队列控制块，head/tail自由递增，帧位置为(index & (depth-1)) */
+typedef struct {
+	__u32 head;					//生产者写入位置
+	__u8 pad0[IOBUS_CACHELINE - 4];
+	__u32 tail;					//消费者读取位置
+	__u8 pad1[IOBUS_CACHELINE - 4];
+	__u32 depth;				//队列深度，2的幂
+	__u32 offset;				//帧数组相对共享区起始的偏移
+	__u32 idle;					//仅发送队列：驱动已停止取帧，入队后需IOBUS_IOC_TX_KICK
+	__u32 stride;				//相邻帧的间距，按缓存行对齐，帧i位于offset + (i & (depth-1)) * stride
+	__u8 pad2[IOBUS_CACHELINE - 16];
+}IOBUS_RING_CTL;
+
+/* mmap共享区首页，其后依次为接收帧数组和发送帧数组 */
+typedef struct {
+	IOBUS_RING_CTL rx;			//驱动生产，用户态消费
+	IOBUS_RING_CTL tx;			//用户态生产，驱动消费
+	__u32 size;					//共享区总大小
+	/* 最近一次发送完成，驱动更新前后各把tx_done_seq加1，奇数表示正在更新 */
+	__u32 tx_done_seq;
+	__u32 tx_done_count;		//发送完成帧数
+	__u64 tx_done_tstamp;		//发送完成中断到达时间，CLOCK_MONOTONIC，单位ns
+	__u32 frame_max;			//最大帧长，队列中帧的data只有frame_max字节可用
+	__u32 reserved;
+}IOBUS_SHM_HDR;
+
+#define IOBUS_SCAN_MAX				256		//扫描表最大项数
+#define IOBUS_SLOT_NUM				256		//扫描结果表项数，按卡件地址索引
+#define IOBUS_SLOTS_OFFSET			0x40000000	//映射扫描结果表时的mmap偏移
+
+/* 扫描表项 */
+typedef struct {
+	__u8 addr;					//卡件地址，写入RPAR，也是结果表的下标
+	__u8 chan;					//发送通道(CHSEL值)，IOBUS_CHAN_KEEP表示不切换
+	__u16 len;					//命令帧长度
+	__u32 timeout_us;			//等待返回的超时时间，单位us，0表示无需返回
+	__u8 data[IOBUS_FRAME_MAX];	//命令帧
+}IOBUS_SCAN_ENTRY;
+
+/* IOBUS_IOC_SCAN_SET参数 */
+typedef struct {
+	__u64 entries;				//IOBUS_SCAN_ENTRY数组
+	__u32 count;				//表项数
+	__u32 period_us;			//扫描周期，单位us
+}IOBUS_SCAN_CFG;
+
+/* 扫描结果 */
+#define IOBUS_SLOT_EMPTY			0	//尚未扫描
+#define IOBUS_SLOT_VALID			1	//最近一次扫描或事务收到返回
+#define IOBUS_SLOT_TIMEOUT			2	//最近一次扫描超时，data为更早的返回
+
+/* 结果表项，结果表可通过mmap偏移IOBUS_SLOTS_OFFSET只读映射到用户态
+ * 驱动更新表项前后各把seq加1，seq为奇数表示正在更新，用户态按如下方式无锁读取一致的快照：
+ *   do { s = slot->seq; rmb(); memcpy(&copy, slot, sizeof(copy)); rmb(); }
+ *   while ((s & 1) || slot->seq != s);
+ */
+typedef struct {
+	__u32 seq;					//更新序号
+	__u32 cycle;				//最近一次更新时的扫描轮数
+	__u8 addr;					//卡件地址，IOBUS_IOC_SCAN_READ的输入
+	__u8 status;				//IOBUS_SLOT_*
+	__u8 rsr;					//返回帧接收状态
+	__u8 reserved;
+	__u16 len;					//返回帧长度
+	__u16 reserved1;
+	__u64 tstamp;				//返回帧接收完成中断到达时间，单位ns
+	__u8 data[IOBUS_FRAME_MAX];
+}IOBUS_SLOT;
+
+#define IOBUS_BCAST_MAX				16		//周期广播帧最大个数
+
+/* 周期广播帧，无需返回，发送时不改写RPAR */
+typedef struct {
+	__u8 chan;					//发送通道(CHSEL值)，IOBUS_CHAN_KEEP表示不切换
+	__u8 reserved;
+	__u16 len;					//帧长度
+	__u32 period_us;			//发送周期，单位us
+	__u8 data[IOBUS_FRAME_MAX];
+}IOBUS_BCAST_ENTRY;
+
+/* IOBUS_IOC_BCAST_SET参数，count为0表示停止全部广播 */
+typedef struct {
+	__u64 entries;				//IOBUS_BCAST_ENTRY数组
+	__u32 count;
+	__u32 reserved;
+}IOBUS_BCAST_CFG;
+
+/* IOBUS_IOC_CH_SEL参数及帧和扫描表项的chan字段，即CPLD的CHSEL值 */
+#define IOBUS_CHAN_1				0x1		//选择通道1
+#define IOBUS_CHAN_2				0		//选择通道2
+#define IOBUS_CHAN_ALL				0x2		//双通道输出，单通道输入
+
+/* IOBUS_IOC_RUN_STAT参数，即CPLD的RUNSTAT值 */
+#define IOBUS_RUN_MASTER			0x1		//主模式，发送时钟
+#define IOBUS_RUN_SLAVE				0		//从模式，接收时钟
+
+#define IOBUS_IOC_MAGIC				'w'
+#define IOBUS_IOC_RUN_STAT			_IOW(IOBUS_IOC_MAGIC, 1, int)	//设置主从
+#define IOBUS_IOC_CH_SEL			_IOW(IOBUS_IOC_MAGIC, 2, int) //通道选择
+#define IOBUS_IOC_LED_STAT			_IOW(IOBUS_IOC_MAGIC, 3, int)
+#define IOBUS_IOC_SET_MODE			_IOW(IOBUS_IOC_MAGIC, 4, int) //读写格式 IOBUS_MODE_*
+#define IOBUS_IOC_TX_KICK			_IO(IOBUS_IOC_MAGIC, 5)	//mmap方式入队后启动发送
+#define IOBUS_IOC_SHM_SIZE			_IOR(IOBUS_IOC_MAGIC, 6, int) //mmap共享区大小
+#define IOBUS_IOC_TRANSACT			_IOWR(IOBUS_IOC_MAGIC, 7, IOBUS_XACT) //发送一帧并等待返回
+#define IOBUS_IOC_SCAN_SET			_IOW(IOBUS_IOC_MAGIC, 8, IOBUS_SCAN_CFG) //设置扫描表
+#define IOBUS_IOC_SCAN_START		_IO(IOBUS_IOC_MAGIC, 9)	//启动周期扫描
+#define IOBUS_IOC_SCAN_STOP			_IO(IOBUS_IOC_MAGIC, 10) //停止周期扫描
+#define IOBUS_IOC_SCAN_READ			_IOWR(IOBUS_IOC_MAGIC, 11, IOBUS_SLOT) //读取一张卡件的扫描结果
+#define IOBUS_IOC_STATS_RESET		_IO(IOBUS_IOC_MAGIC, 12) //统计计数和直方图清零
+#define IOBUS_IOC_BUSY_POLL			_IOW(IOBUS_IOC_MAGIC, 13, int) //read和事务等待前忙轮询的时间，单位us，0为关闭
+#define IOBUS_IOC_COALESCE			_IOW(IOBUS_IOC_MAGIC, 14, IOBUS_COALESCE) //设置接收中断合并
+#define IOBUS_IOC_REG_BATCH			_IOWR(IOBUS_IOC_MAGIC, 15, IOBUS_REG_BATCH) //一次持锁批量读写CPLD寄存器
+#define IOBUS_IOC_RX_FILTER			_IOW(IOBUS_IOC_MAGIC, 16, IOBUS_RX_FILTER) //按卡件地址过滤本文件接收的帧
+#define IOBUS_IOC_REDUNDANT			_IOW(IOBUS_IOC_MAGIC, 17, IOBUS_REDUNDANT) //设置冗余通道发送
+#define IOBUS_IOC_BCAST_SET			_IOW(IOBUS_IOC_MAGIC, 18, IOBUS_BCAST_CFG) //设置周期广播帧
+#define IOBUS_IOC_RX_ERRORS			_IOW(IOBUS_IOC_MAGIC, 19, int) //非0时出错帧以描述符交给用户态
+#define IOBUS_IOC_MAXNR				20
+#define IOBUS_COALESCE_MAX_IDLE_US	1000	//中断合并空闲时间上限
+#define IOBUS_BUSY_POLL_MAX_US		10000	//忙轮询时间上限
+
+/* 读写格式 */
+#define IOBUS_MODE_RAW				0	//每次read/write一帧原始HDLC数据，首字节为卡件地址
+#define IOBUS_MODE_FRAMED			1	//每次read/write多帧，每帧前带帧头，帧间按IOBUS_HDR_ALIGN对齐
+
+#define IOBUS_HDR_ALIGN				8
+#define IOBUS_FRAME_ALIGN(len)		(((len) + IOBUS_HDR_ALIGN - 1) & ~(IOBUS_HDR_ALIGN - 1))
+#define IOBUS_CHAN_KEEP				0xFF	//发送时不切换通道
+#define IOBUS_TXF_KEEP_RPAR			0x1		//发送时不改写RPAR，用于无需返回的广播
+
+/* IOBUS_IOC_REG_BATCH的一项操作 */
+#define IOBUS_REG_READ				0
+#define IOBUS_REG_WRITE				1
+#define IOBUS_REG_BATCH_MAX			64		//一次批量操作的最大项数，全部在关中断持锁下执行
+
+typedef struct {
+	__u8 op;					//IOBUS_REG_*
+	__u8 value;					//写入值，读操作时输出读到的值
+	__u16 addr;					//CPLD寄存器地址，0x100至板上译码空间末尾(9根地址线时为0x1FF)
+}IOBUS_REG_OP;
+
+/* IOBUS_IOC_REG_BATCH参数 */
+typedef struct {
+	__u64 ops;					//IOBUS_REG_OP数组，执行后读操作的value被回写
+	__u32 count;				//项数
+	__u32 reserved;
+}IOBUS_REG_BATCH;
+
+/* IOBUS_IOC_RX_FILTER参数，与RPAR/RPAMR1相同，mask中为1的位参与比较
+ * 接收帧的卡件地址满足(addr & mask) == (filter.addr & mask)时只交给该文件，
+ * 多个文件匹配时交给最早设置过滤的文件，都不匹配时进入共享接收队列
+ */
+typedef struct {
+	__u8 addr;
+	__u8 mask;
+	__u16 reserved;
+}IOBUS_RX_FILTER;
+
+/* IOBUS_IOC_REDUNDANT参数
+ * 使能后事务和需返回的扫描表项忽略自身的chan，先在primary上发送并等待返回，
+ * 超时后在同一事务内切换到backup重发一次，重发收到返回则两者互换，后续命令先走好的通道
+ * 典型设置为primary=CHALLSEL(双通道输出，单通道输入)，backup为另一路输入通道
+ */
+typedef struct {
+	__u8 enable;
+	__u8 primary;				//CHSEL值
+	__u8 backup;				//CHSEL值
+	__u8 reserved;
+}IOBUS_REDUNDANT;
+
+/* IOBUS_IOC_COALESCE参数 */
+typedef struct {
+	__u32 budget;				//一次轮询最多处理的收发完成事件数，0表示关闭
+	__u32 idle_us;				//总线空闲超过该时间结束轮询并重新使能中断
+}IOBUS_COALESCE;
+
+/* IOBUS_IOC_TRANSACT参数 */
+typedef struct {
+	__u64 tx_buf;				//发送帧数据
+	__u64 rx_buf;				//返回帧缓存
+	__u16 tx_len;				//发送帧长度
+	__u16 rx_size;				//返回帧缓存大小
+	__u16 rx_len;				//输出：返回帧长度，超出rx_size部分被截断
+	__u8 addr;					//卡件地址，写入RPAR
+	__u8 chan;					//发送通道(CHSEL值)，IOBUS_CHAN_KEEP表示不切换
+	__u32 timeout_us;			//等待返回的超时时间，单位us
+	__u8 rsr;					//输出：返回帧接收状态
+	__u8 reserved[3];
+	__u64 tstamp;				//输出：返回帧接收完成中断到达时间，CLOCK_MONOTONIC，单位ns
+}IOBUS_XACT;
+
+/* FRAMED格式下write的帧头，其后紧跟len字节数据 */
+typedef struct {
+	__u16 len;					//数据长度
+	__u8 addr;					//卡件地址，写入RPAR
+	__u8 chan;					//发送通道(CHSEL值)，IOBUS_CHAN_KEEP表示不切换
+	__u16 flags;				//IOBUS_TXF_*
+	__u16 reserved;
+}IOBUS_TX_HDR;
+
+/* FRAMED格式下read的帧头，其后紧跟len字节数据 */
+typedef struct {
+	__u16 len;					//数据长度，0表示出错帧的描述符(IOBUS_IOC_RX_ERRORS)
+	__u8 rsr;					//接收状态寄存器
+	__u8 chan;					//接收时的通道选择
+	__u8 addr;					//接收时RPAR中的卡件地址
+	__u8 reserved[3];
+	__u64 tstamp;				//接收完成中断到达时间，CLOCK_MONOTONIC，单位ns
+}IOBUS_RX_HDR;
+
+#endif /* _IOBUS_IOCTL_H_ */
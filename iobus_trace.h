@@ -0,0 +1,141 @@
+/**
+  * @brief  iobus帧收发各阶段的跟踪点，未使能时几乎无开销
+  *         使能：echo 1 > /sys/kernel/debug/tracing/events/iobus/enable
+  *         可与调度、其他中断事件一起用ftrace/perf分析总线时序，取代原gpio1_8示波器探针
+  */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM iobus
+
+#if !defined(_IOBUS_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _IOBUS_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+/* write系统调用入口 */
+TRACE_EVENT(iobus_write,
+	TP_PROTO(size_t count, int mode),
+	TP_ARGS(count, mode),
+	TP_STRUCT__entry(
+		__field(size_t, count)
+		__field(int, mode)
+	),
+	TP_fast_assign(
+		__entry->count = count;
+		__entry->mode = mode;
+	),
+	TP_printk("count=%zu mode=%d", __entry->count, __entry->mode)
+);
+
+/* 一帧已写入发送双口RAM */
+TRACE_EVENT(iobus_tx_fill,
+	TP_PROTO(unsigned char addr, unsigned char chan, unsigned short len),
+	TP_ARGS(addr, chan, len),
+	TP_STRUCT__entry(
+		__field(unsigned char, addr)
+		__field(unsigned char, chan)
+		__field(unsigned short, len)
+	),
+	TP_fast_assign(
+		__entry->addr = addr;
+		__entry->chan = chan;
+		__entry->len = len;
+	),
+	TP_printk("addr=0x%02x chan=%u len=%u", __entry->addr, __entry->chan, __entry->len)
+);
+
+/* 已置HSND_EN，CPLD开始发送 */
+TRACE_EVENT(iobus_tx_start,
+	TP_PROTO(unsigned short len),
+	TP_ARGS(len),
+	TP_STRUCT__entry(
+		__field(unsigned short, len)
+	),
+	TP_fast_assign(
+		__entry->len = len;
+	),
+	TP_printk("len=%u", __entry->len)
+);
+
+/* 中断顶半部，时刻即CPLD中断到达时刻 */
+TRACE_EVENT(iobus_irq,
+	TP_PROTO(unsigned char isr, unsigned char rsr),
+	TP_ARGS(isr, rsr),
+	TP_STRUCT__entry(
+		__field(unsigned char, isr)
+		__field(unsigned char, rsr)
+	),
+	TP_fast_assign(
+		__entry->isr = isr;
+		__entry->rsr = rsr;
+	),
+	TP_printk("isr=0x%02x rsr=0x%02x", __entry->isr, __entry->rsr)
+);
+
+/* 中断线程处理发送完成 */
+TRACE_EVENT(iobus_tmc,
+	TP_PROTO(unsigned short len),
+	TP_ARGS(len),
+	TP_STRUCT__entry(
+		__field(unsigned short, len)
+	),
+	TP_fast_assign(
+		__entry->len = len;
+	),
+	TP_printk("len=%u", __entry->len)
+);
+
+/* 中断线程处理接收完成，rsr非0时len为0，见hdlc_recv_error */
+TRACE_EVENT(iobus_rmc,
+	TP_PROTO(unsigned char rsr, int len, int owner),
+	TP_ARGS(rsr, len, owner),
+	TP_STRUCT__entry(
+		__field(unsigned char, rsr)
+		__field(int, len)
+		__field(int, owner)
+	),
+	TP_fast_assign(
+		__entry->rsr = rsr;
+		__entry->len = len;
+		__entry->owner = owner;
+	),
+	TP_printk("rsr=0x%02x len=%d owner=%d", __entry->rsr, __entry->len, __entry->owner)
+);
+
+/* 接收双口RAM已读完，接收已重新使能 */
+TRACE_EVENT(iobus_rx_drain,
+	TP_PROTO(int len, int owner),
+	TP_ARGS(len, owner),
+	TP_STRUCT__entry(
+		__field(int, len)
+		__field(int, owner)
+	),
+	TP_fast_assign(
+		__entry->len = len;
+		__entry->owner = owner;
+	),
+	TP_printk("len=%d owner=%d", __entry->len, __entry->owner)
+);
+
+/* read系统调用返回 */
+TRACE_EVENT(iobus_read,
+	TP_PROTO(size_t count, ssize_t ret),
+	TP_ARGS(count, ret),
+	TP_STRUCT__entry(
+		__field(size_t, count)
+		__field(ssize_t, ret)
+	),
+	TP_fast_assign(
+		__entry->count = count;
+		__entry->ret = ret;
+	),
+	TP_printk("count=%zu ret=%zd", __entry->count, __entry->ret)
+);
+
+#endif /* _IOBUS_TRACE_H_ */
+
+/* define_trace.h需在TRACE_HEADER_MULTI_READ保护之外 */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE iobus_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,296 @@
+/**
+  * @brief  iobus负载发生与测量工具，用于驱动版本和硬件的验收
+  *         xact   请求/应答：逐帧IOBUS_IOC_TRANSACT，延迟为一次事务的往返时间
+  *         bcast  广播洪泛：FRAMED格式每次write批量写入无需返回的帧，延迟为一次write的耗时(含发送队列满时的等待)
+  *         scan   整轮扫描：驱动按周期扫描N张卡件，从映射的结果表统计每轮完成的间隔和超时的表项
+  *         结果给出帧数、帧/s、字节/s和延迟的p50/p90/p99/p99.9/max
+  *         例：iobus_bench -p xact -a 0x10 -l 16 -t 10
+  *             iobus_bench -d 1 -p bcast -b 32 -l 64
+  *             iobus_bench -p scan -n 64 -P 10000
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include "libiobus.h"
+
+#define BENCH_MAX_SAMPLES		(1 << 20)	//最多保存的延迟样本数，超出后只更新计数
+
+typedef struct {
+	int dev;					//控制器序号
+	const char *pattern;
+	unsigned int seconds;		//测量时间
+	unsigned int addr;			//卡件地址，scan为起始地址
+	unsigned int chan;
+	unsigned int len;			//帧长度
+	unsigned int timeout_us;	//等待返回的超时时间
+	unsigned int batch;			//bcast每次write的帧数
+	unsigned int cards;			//scan的卡件数
+	unsigned int period_us;		//scan的扫描周期
+	unsigned int busy_poll_us;
+}BENCH_OPTS;
+
+typedef struct {
+	__u64 frames;
+	__u64 bytes;
+	__u64 errors;				//超时或出错的帧
+	__u64 *samples;				//延迟样本，单位ns
+	unsigned int count;
+}BENCH_RESULT;
+
+static volatile sig_atomic_t bench_stop;
+
+static void bench_sigint(int sig)
+{
+	(void)sig;
+	bench_stop = 1;
+}
+
+static void bench_sample(BENCH_RESULT *res, __u64 ns)
+{
+	if (res->count < BENCH_MAX_SAMPLES)
+		res->samples[res->count++] = ns;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	__u64 x = *(const __u64 *)a;
+	__u64 y = *(const __u64 *)b;
+	return x < y ? -1 : x > y;
+}
+
+static __u64 bench_pct(const BENCH_RESULT *res, unsigned int permille)
+{
+	unsigned int i = 0;
+	if (res->count == 0)
+		return 0;
+	i = (unsigned long long)res->count * permille / 1000;
+	if (i >= res->count)
+		i = res->count - 1;
+	return res->samples[i];
+}
+
+static void bench_report(const char *name, BENCH_RESULT *res, __u64 elapsed_ns)
+{
+	double sec = elapsed_ns / 1e9;
+	qsort(res->samples, res->count, sizeof(__u64), bench_cmp);
+	printf("%s: %llu frames in %.3f s, %llu errors\n", name,
+		   (unsigned long long)res->frames, sec, (unsigned long long)res->errors);
+	printf("  %.1f frames/s  %.1f bytes/s\n", res->frames / sec, res->bytes / sec);
+	if (res->count == 0)
+		return;
+	printf("  latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f  (%u samples)\n",
+		   bench_pct(res, 500) / 1e3, bench_pct(res, 900) / 1e3, bench_pct(res, 990) / 1e3,
+		   bench_pct(res, 999) / 1e3, res->samples[res->count - 1] / 1e3, res->count);
+}
+
+/**
+  * @brief  请求/应答，一次一个事务
+  */
+static int bench_xact(IOBUS_HANDLE *h, const BENCH_OPTS *opt, BENCH_RESULT *res, __u64 end)
+{
+	int ret = 0;
+	__u64 t0 = 0;
+	unsigned char tx[IOBUS_FRAME_MAX];
+	unsigned char rx[IOBUS_FRAME_MAX];
+	memset(tx, 0x55, sizeof(tx));
+	tx[0] = opt->addr;
+	while (!bench_stop && (t0 = iobus_now_ns()) < end)
+	{
+		ret = iobus_request(h, opt->addr, opt->chan, tx, opt->len, rx, sizeof(rx), opt->timeout_us, NULL);
+		if (ret == -ETIMEDOUT)
+		{
+			res->errors++;
+			continue;
+		}
+		if (ret < 0)
+			return ret;
+		bench_sample(res, iobus_now_ns() - t0);
+		res->frames++;
+		res->bytes += opt->len + ret;
+	}
+	return 0;
+}
+
+/**
+  * @brief  广播洪泛，FRAMED格式每次write批量写入opt->batch帧
+  */
+static int bench_bcast(IOBUS_HANDLE *h, const BENCH_OPTS *opt, BENCH_RESULT *res, __u64 end)
+{
+	int ret = 0;
+	unsigned int i = 0;
+	__u64 t0 = 0;
+	size_t size = opt->batch * IOBUS_FRAME_ALIGN(sizeof(IOBUS_TX_HDR) + IOBUS_FRAME_MAX);
+	unsigned char data[IOBUS_FRAME_MAX];
+	void *buf = malloc(size);
+	IOBUS_BATCH batch;
+	if (buf == NULL)
+		return -ENOMEM;
+	ret = iobus_set_mode(h, IOBUS_MODE_FRAMED);
+	if (ret)
+		goto out;
+	memset(data, 0xAA, sizeof(data));
+	iobus_batch_init(&batch, buf, size);
+	while (!bench_stop && (t0 = iobus_now_ns()) < end)
+	{
+		for (i=batch.count; i<opt->batch; i++)
+			iobus_batch_add(&batch, opt->addr, opt->chan, IOBUS_TXF_KEEP_RPAR, data, opt->len);
+		ret = iobus_batch_send(h, &batch);
+		if (ret < 0)
+			goto out;
+		bench_sample(res, iobus_now_ns() - t0);
+		res->frames += ret;
+		res->bytes += (__u64)ret * opt->len;
+	}
+	ret = 0;
+out:
+	iobus_set_mode(h, IOBUS_MODE_RAW);
+	free(buf);
+	return ret;
+}
+
+/**
+  * @brief  整轮扫描，轮询结果表中最后一张卡件的cycle，每完成一轮记录一次间隔
+  */
+static int bench_scan(IOBUS_HANDLE *h, const BENCH_OPTS *opt, BENCH_RESULT *res, __u64 end)
+{
+	int ret = 0;
+	unsigned int i = 0;
+	unsigned int last_cycle = 0;
+	__u64 last_ns = 0;
+	__u64 now = 0;
+	IOBUS_SLOT slot;
+	IOBUS_SCAN_ENTRY *tab = calloc(opt->cards, sizeof(IOBUS_SCAN_ENTRY));
+	if (tab == NULL)
+		return -ENOMEM;
+	for (i=0; i<opt->cards; i++)
+	{
+		tab[i].addr = opt->addr + i;
+		tab[i].chan = opt->chan;
+		tab[i].len = opt->len;
+		tab[i].timeout_us = opt->timeout_us;
+		memset(tab[i].data, 0x55, opt->len);
+		tab[i].data[0] = tab[i].addr;
+	}
+	ret = iobus_scan_set(h, tab, opt->cards, opt->period_us);
+	if (ret)
+		goto out;
+	ret = iobus_slots_map(h);
+	if (ret)
+		goto out;
+	iobus_slot_read(h, opt->addr + opt->cards - 1, &slot);
+	last_cycle = slot.cycle;
+	ret = iobus_scan_start(h);
+	if (ret)
+		goto out;
+	while (!bench_stop && (now = iobus_now_ns()) < end)
+	{
+		iobus_slot_read(h, opt->addr + opt->cards - 1, &slot);
+		if (slot.cycle == last_cycle)
+		{
+			usleep(opt->period_us / 10 ? opt->period_us / 10 : 1);
+			continue;
+		}
+		/* 一轮完成，统计本轮各卡件的结果 */
+		for (i=0; i<opt->cards; i++)
+		{
+			iobus_slot_read(h, opt->addr + i, &slot);
+			if (slot.status == IOBUS_SLOT_VALID)
+			{
+				res->frames++;
+				res->bytes += opt->len + slot.len;
+			}
+			else
+				res->errors++;
+		}
+		if (last_ns != 0)
+			bench_sample(res, now - last_ns);
+		last_ns = now;
+		last_cycle = slot.cycle;
+	}
+	iobus_scan_stop(h);
+	ret = 0;
+out:
+	free(tab);
+	return ret;
+}
+
+static void bench_usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d dev] [-p xact|bcast|scan] [-t seconds] [-a addr] [-c chan] [-l len]\n"
+		"          [-T timeout_us] [-b batch] [-n cards] [-P period_us] [-B busy_poll_us]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	int c = 0;
+	int ret = 0;
+	__u64 start = 0;
+	IOBUS_HANDLE h;
+	BENCH_RESULT res;
+	BENCH_OPTS opt = {
+		.dev = 0, .pattern = "xact", .seconds = 5, .addr = 0x10, .chan = IOBUS_CHAN_KEEP,
+		.len = 16, .timeout_us = 1000, .batch = 16, .cards = 16, .period_us = 10000, .busy_poll_us = 0,
+	};
+	while ((c = getopt(argc, argv, "d:p:t:a:c:l:T:b:n:P:B:h")) != -1)
+	{
+		switch (c)
+		{
+			case 'd': opt.dev = atoi(optarg); break;
+			case 'p': opt.pattern = optarg; break;
+			case 't': opt.seconds = strtoul(optarg, NULL, 0); break;
+			case 'a': opt.addr = strtoul(optarg, NULL, 0); break;
+			case 'c': opt.chan = strtoul(optarg, NULL, 0); break;
+			case 'l': opt.len = strtoul(optarg, NULL, 0); break;
+			case 'T': opt.timeout_us = strtoul(optarg, NULL, 0); break;
+			case 'b': opt.batch = strtoul(optarg, NULL, 0); break;
+			case 'n': opt.cards = strtoul(optarg, NULL, 0); break;
+			case 'P': opt.period_us = strtoul(optarg, NULL, 0); break;
+			case 'B': opt.busy_poll_us = strtoul(optarg, NULL, 0); break;
+			default: bench_usage(argv[0]); return 2;
+		}
+	}
+	if (opt.len == 0 || opt.len > IOBUS_FRAME_MAX || opt.batch == 0 ||
+		opt.cards == 0 || opt.cards > IOBUS_SCAN_MAX || opt.addr + opt.cards > IOBUS_SLOT_NUM)
+	{
+		bench_usage(argv[0]);
+		return 2;
+	}
+	memset(&res, 0, sizeof(res));
+	res.samples = malloc(BENCH_MAX_SAMPLES * sizeof(__u64));
+	if (res.samples == NULL)
+		return 1;
+	ret = iobus_open(&h, opt.dev, 0);
+	if (ret)
+	{
+		fprintf(stderr, "can't open " IOBUS_DEV_PATH ": %s\n", opt.dev, strerror(-ret));
+		return 1;
+	}
+	if (opt.busy_poll_us)
+		iobus_set_busy_poll(&h, opt.busy_poll_us);
+	signal(SIGINT, bench_sigint);
+	start = iobus_now_ns();
+	if (strcmp(opt.pattern, "xact") == 0)
+		ret = bench_xact(&h, &opt, &res, start + opt.seconds * 1000000000ULL);
+	else if (strcmp(opt.pattern, "bcast") == 0)
+		ret = bench_bcast(&h, &opt, &res, start + opt.seconds * 1000000000ULL);
+	else if (strcmp(opt.pattern, "scan") == 0)
+		ret = bench_scan(&h, &opt, &res, start + opt.seconds * 1000000000ULL);
+	else
+	{
+		bench_usage(argv[0]);
+		ret = -EINVAL;
+	}
+	if (opt.busy_poll_us)
+		iobus_set_busy_poll(&h, 0);
+	if (ret == 0)
+		bench_report(opt.pattern, &res, iobus_now_ns() - start);
+	else
+		fprintf(stderr, "%s: %s\n", opt.pattern, strerror(-ret));
+	iobus_close(&h);
+	free(res.samples);
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+/**
+  * @brief  iobus驱动接口检查，在目标板或加载了sim后端的主机上运行，全部通过返回0
+  *         例：iobus_test -d 0
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "libiobus.h"
+
+static int test_failed;
+
+#define TEST_EXPECT(cond, name)									\
+	do {														\
+		if (cond)												\
+			printf("ok    %s\n", name);							\
+		else													\
+		{														\
+			printf("FAIL  %s\n", name);							\
+			test_failed++;										\
+		}														\
+	} while (0)
+
+/**
+  * @brief  IOBUS_IOC_REG_BATCH只接受寄存器地址，双口RAM及回绕到双口RAM的地址一律拒绝
+  *         被拒绝的批量操作整体不执行，这里只用读操作，不影响总线
+  */
+static void test_reg_batch_range(IOBUS_HANDLE *h)
+{
+	IOBUS_REG_OP op;
+	memset(&op, 0, sizeof(op));
+	op.op = IOBUS_REG_READ;
+	op.addr = 0x100;
+	TEST_EXPECT(iobus_reg_batch(h, &op, 1) == 0, "reg_batch accepts 0x100");
+	op.addr = 0x1FF;
+	TEST_EXPECT(iobus_reg_batch(h, &op, 1) == 0, "reg_batch accepts 0x1ff");
+	op.addr = 0x0FF;
+	TEST_EXPECT(iobus_reg_batch(h, &op, 1) == -EINVAL, "reg_batch rejects dpram 0x0ff");
+	op.addr = 0x200;
+	TEST_EXPECT(iobus_reg_batch(h, &op, 1) == -EINVAL, "reg_batch rejects 0x200 (wraps to dpram)");
+	op.addr = 0x2FF;
+	TEST_EXPECT(iobus_reg_batch(h, &op, 1) == -EINVAL, "reg_batch rejects 0x2ff (wraps to dpram)");
+}
+
+int main(int argc, char *argv[])
+{
+	int c = 0;
+	int dev = 0;
+	int ret = 0;
+	IOBUS_HANDLE h;
+	while ((c = getopt(argc, argv, "d:h")) != -1)
+	{
+		switch (c)
+		{
+			case 'd': dev = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-d dev]\n", argv[0]);
+				return 2;
+		}
+	}
+	ret = iobus_open(&h, dev, 0);
+	if (ret)
+	{
+		fprintf(stderr, "can't open " IOBUS_DEV_PATH ": %s\n", dev, strerror(-ret));
+		return 1;
+	}
+	test_reg_batch_range(&h);
+	iobus_close(&h);
+	printf("%s\n", test_failed ? "FAILED" : "PASSED");
+	return test_failed ? 1 : 0;
+}
@@ -0,0 +1,372 @@
+/**
+  * @brief  iobus用户态库实现，接口说明见libiobus.h
+  */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "libiobus.h"
+
+/* 与驱动共享的队列控制字段需每次从内存读写 */
+#define IOBUS_ACCESS(x)			(*(volatile __typeof__(x) *)&(x))
+#define iobus_mb()				__sync_synchronize()
+
+static int iobus_ioctl(IOBUS_HANDLE *h, unsigned long cmd, void *arg)
+{
+	if (ioctl(h->fd, cmd, arg) < 0)
+		return -errno;
+	return 0;
+}
+
+/* 整数参数的命令，驱动直接使用arg的值 */
+static int iobus_ioctl_int(IOBUS_HANDLE *h, unsigned long cmd, unsigned long arg)
+{
+	if (ioctl(h->fd, cmd, arg) < 0)
+		return -errno;
+	return 0;
+}
+
+int iobus_open(IOBUS_HANDLE *h, int index, int flags)
+{
+	char path[32];
+	memset(h, 0, sizeof(*h));
+	snprintf(path, sizeof(path), IOBUS_DEV_PATH, index);
+	h->fd = open(path, O_RDWR | flags);
+	if (h->fd < 0)
+		return -errno;
+	h->mode = IOBUS_MODE_RAW;
+	return 0;
+}
+
+void iobus_close(IOBUS_HANDLE *h)
+{
+	iobus_slots_unmap(h);
+	iobus_shm_unmap(h);
+	if (h->fd >= 0)
+		close(h->fd);
+	h->fd = -1;
+}
+
+int iobus_set_mode(IOBUS_HANDLE *h, int mode)
+{
+	int ret = iobus_ioctl_int(h, IOBUS_IOC_SET_MODE, mode);
+	if (ret == 0)
+		h->mode = mode;
+	return ret;
+}
+
+int iobus_set_chan(IOBUS_HANDLE *h, int chan)
+{
+	return iobus_ioctl_int(h, IOBUS_IOC_CH_SEL, chan);
+}
+
+int iobus_set_run_stat(IOBUS_HANDLE *h, int stat)
+{
+	return iobus_ioctl_int(h, IOBUS_IOC_RUN_STAT, stat);
+}
+
+int iobus_set_led(IOBUS_HANDLE *h, int led)
+{
+	return iobus_ioctl_int(h, IOBUS_IOC_LED_STAT, led);
+}
+
+int iobus_set_busy_poll(IOBUS_HANDLE *h, unsigned int us)
+{
+	return iobus_ioctl_int(h, IOBUS_IOC_BUSY_POLL, us);
+}
+
+int iobus_set_rx_errors(IOBUS_HANDLE *h, int enable)
+{
+	return iobus_ioctl_int(h, IOBUS_IOC_RX_ERRORS, enable != 0);
+}
+
+int iobus_set_redundant(IOBUS_HANDLE *h, int enable, int primary, int backup)
+{
+	IOBUS_REDUNDANT red;
+	memset(&red, 0, sizeof(red));
+	red.enable = enable != 0;
+	red.primary = primary;
+	red.backup = backup;
+	return iobus_ioctl(h, IOBUS_IOC_REDUNDANT, &red);
+}
+
+int iobus_stats_reset(IOBUS_HANDLE *h)
+{
+	return iobus_ioctl_int(h, IOBUS_IOC_STATS_RESET, 0);
+}
+
+int iobus_reg_batch(IOBUS_HANDLE *h, IOBUS_REG_OP *ops, unsigned int count)
+{
+	IOBUS_REG_BATCH batch;
+	memset(&batch, 0, sizeof(batch));
+	batch.ops = (unsigned long)ops;
+	batch.count = count;
+	return iobus_ioctl(h, IOBUS_IOC_REG_BATCH, &batch);
+}
+
+int iobus_transact(IOBUS_HANDLE *h, IOBUS_XACT *xact)
+{
+	int ret = iobus_ioctl(h, IOBUS_IOC_TRANSACT, xact);
+	if (ret)
+		return ret;
+	return xact->rx_len;
+}
+
+int iobus_request(IOBUS_HANDLE *h, unsigned char addr, unsigned char chan, const void *tx, size_t tx_len,
+				  void *rx, size_t rx_size, unsigned int timeout_us, __u64 *tstamp)
+{
+	int ret = 0;
+	IOBUS_XACT xact;
+	if (tx_len == 0 || tx_len > IOBUS_FRAME_MAX)
+		return -EINVAL;
+	memset(&xact, 0, sizeof(xact));
+	xact.tx_buf = (unsigned long)tx;
+	xact.rx_buf = (unsigned long)rx;
+	xact.tx_len = tx_len;
+	xact.rx_size = rx_size > IOBUS_FRAME_MAX ? IOBUS_FRAME_MAX : rx_size;
+	xact.addr = addr;
+	xact.chan = chan;
+	xact.timeout_us = timeout_us;
+	ret = iobus_transact(h, &xact);
+	if (ret >= 0 && tstamp != NULL)
+		*tstamp = xact.tstamp;
+	return ret;
+}
+
+void iobus_batch_init(IOBUS_BATCH *b, void *buf, size_t size)
+{
+	b->buf = (unsigned char *)buf;
+	b->size = size;
+	b->len = 0;
+	b->count = 0;
+}
+
+int iobus_batch_add(IOBUS_BATCH *b, unsigned char addr, unsigned char chan, unsigned short flags, const void *data, size_t len)
+{
+	IOBUS_TX_HDR hdr;
+	size_t need = IOBUS_FRAME_ALIGN(sizeof(hdr) + len);
+	if (len == 0 || len > IOBUS_FRAME_MAX)
+		return -EINVAL;
+	if (b->len + need > b->size)
+		return -ENOSPC;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.len = len;
+	hdr.addr = addr;
+	hdr.chan = chan;
+	hdr.flags = flags;
+	memcpy(b->buf + b->len, &hdr, sizeof(hdr));
+	memcpy(b->buf + b->len + sizeof(hdr), data, len);
+	/* 对齐填充清零，避免把未初始化的内存交给驱动 */
+	memset(b->buf + b->len + sizeof(hdr) + len, 0, need - sizeof(hdr) - len);
+	b->len += need;
+	b->count++;
+	return 0;
+}
+
+int iobus_batch_send(IOBUS_HANDLE *h, IOBUS_BATCH *b)
+{
+	ssize_t n = 0;
+	size_t off = 0;
+	unsigned int frames = 0;
+	IOBUS_TX_HDR hdr;
+	if (b->count == 0)
+		return 0;
+	n = write(h->fd, b->buf, b->len);
+	if (n < 0)
+		return -errno;
+	/* 驱动按整帧接受，返回值落在帧边界上(最后一帧不含对齐填充) */
+	while (off < (size_t)n && frames < b->count)
+	{
+		memcpy(&hdr, b->buf + off, sizeof(hdr));
+		off += IOBUS_FRAME_ALIGN(sizeof(hdr) + hdr.len);
+		frames++;
+	}
+	if (off > b->len)
+		off = b->len;
+	memmove(b->buf, b->buf + off, b->len - off);
+	b->len -= off;
+	b->count -= frames;
+	return frames;
+}
+
+ssize_t iobus_recv(IOBUS_HANDLE *h, void *buf, size_t size)
+{
+	ssize_t n = read(h->fd, buf, size);
+	if (n < 0)
+		return -errno;
+	return n;
+}
+
+const IOBUS_RX_HDR *iobus_rx_next(const void *buf, size_t len, size_t *off)
+{
+	const IOBUS_RX_HDR *hdr = NULL;
+	if (*off + sizeof(IOBUS_RX_HDR) > len)
+		return NULL;
+	hdr = (const IOBUS_RX_HDR *)((const unsigned char *)buf + *off);
+	if (*off + sizeof(IOBUS_RX_HDR) + hdr->len > len)
+		return NULL;
+	*off += IOBUS_FRAME_ALIGN(sizeof(IOBUS_RX_HDR) + hdr->len);
+	return hdr;
+}
+
+int iobus_shm_map(IOBUS_HANDLE *h)
+{
+	int size = 0;
+	void *shm = NULL;
+	int ret = iobus_ioctl(h, IOBUS_IOC_SHM_SIZE, &size);
+	if (ret)
+		return ret;
+	shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, h->fd, 0);
+	if (shm == MAP_FAILED)
+		return -errno;
+	h->shm = shm;
+	h->shm_size = size;
+	h->hdr = (IOBUS_SHM_HDR *)shm;
+	h->rx_frames = (unsigned char *)shm + h->hdr->rx.offset;
+	h->tx_frames = (unsigned char *)shm + h->hdr->tx.offset;
+	h->frame_max = h->hdr->frame_max;
+	return 0;
+}
+
+void iobus_shm_unmap(IOBUS_HANDLE *h)
+{
+	if (h->shm == NULL)
+		return;
+	munmap(h->shm, h->shm_size);
+	h->shm = NULL;
+	h->hdr = NULL;
+	h->rx_frames = NULL;
+	h->tx_frames = NULL;
+}
+
+IOBUS_FRAME *iobus_rx_peek(IOBUS_HANDLE *h)
+{
+	IOBUS_RING_CTL *ctl = &h->hdr->rx;
+	__u32 tail = ctl->tail;
+	if (IOBUS_ACCESS(ctl->head) == tail)
+		return NULL;
+	/* 先看到head再读取帧内容，与驱动ring_push配对 */
+	iobus_mb();
+	return (IOBUS_FRAME *)(h->rx_frames + (tail & (ctl->depth - 1)) * ctl->stride);
+}
+
+void iobus_rx_release(IOBUS_HANDLE *h)
+{
+	IOBUS_RING_CTL *ctl = &h->hdr->rx;
+	/* 帧内容读取完毕后再把空间还给驱动 */
+	iobus_mb();
+	IOBUS_ACCESS(ctl->tail) = ctl->tail + 1;
+}
+
+IOBUS_FRAME *iobus_tx_slot(IOBUS_HANDLE *h)
+{
+	IOBUS_RING_CTL *ctl = &h->hdr->tx;
+	__u32 head = ctl->head;
+	if (head - IOBUS_ACCESS(ctl->tail) >= ctl->depth)
+		return NULL;
+	iobus_mb();
+	return (IOBUS_FRAME *)(h->tx_frames + (head & (ctl->depth - 1)) * ctl->stride);
+}
+
+int iobus_tx_commit(IOBUS_HANDLE *h)
+{
+	IOBUS_RING_CTL *ctl = &h->hdr->tx;
+	/* 帧内容对驱动可见后再移动head */
+	iobus_mb();
+	IOBUS_ACCESS(ctl->head) = ctl->head + 1;
+	/* 与驱动置idle后复查队列配对：驱动已停止取帧时才需要启动 */
+	iobus_mb();
+	if (IOBUS_ACCESS(ctl->idle))
+		return iobus_ioctl_int(h, IOBUS_IOC_TX_KICK, 0);
+	return 0;
+}
+
+void iobus_tx_done(IOBUS_HANDLE *h, __u32 *count, __u64 *tstamp)
+{
+	__u32 seq = 0;
+	IOBUS_SHM_HDR *hdr = h->hdr;
+	do {
+		seq = IOBUS_ACCESS(hdr->tx_done_seq);
+		iobus_mb();
+		*count = IOBUS_ACCESS(hdr->tx_done_count);
+		*tstamp = IOBUS_ACCESS(hdr->tx_done_tstamp);
+		iobus_mb();
+	} while ((seq & 1) || IOBUS_ACCESS(hdr->tx_done_seq) != seq);
+}
+
+int iobus_scan_set(IOBUS_HANDLE *h, const IOBUS_SCAN_ENTRY *entries, unsigned int count, unsigned int period_us)
+{
+	IOBUS_SCAN_CFG cfg;
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.entries = (unsigned long)entries;
+	cfg.count = count;
+	cfg.period_us = period_us;
+	return iobus_ioctl(h, IOBUS_IOC_SCAN_SET, &cfg);
+}
+
+int iobus_scan_start(IOBUS_HANDLE *h)
+{
+	return iobus_ioctl_int(h, IOBUS_IOC_SCAN_START, 0);
+}
+
+int iobus_scan_stop(IOBUS_HANDLE *h)
+{
+	return iobus_ioctl_int(h, IOBUS_IOC_SCAN_STOP, 0);
+}
+
+int iobus_slots_map(IOBUS_HANDLE *h)
+{
+	void *slots = mmap(NULL, IOBUS_SLOT_NUM * sizeof(IOBUS_SLOT), PROT_READ, MAP_SHARED, h->fd, IOBUS_SLOTS_OFFSET);
+	if (slots == MAP_FAILED)
+		return -errno;
+	h->slots = (const IOBUS_SLOT *)slots;
+	return 0;
+}
+
+void iobus_slots_unmap(IOBUS_HANDLE *h)
+{
+	if (h->slots == NULL)
+		return;
+	munmap((void *)h->slots, IOBUS_SLOT_NUM * sizeof(IOBUS_SLOT));
+	h->slots = NULL;
+}
+
+int iobus_slot_read(IOBUS_HANDLE *h, unsigned char addr, IOBUS_SLOT *slot)
+{
+	__u32 seq = 0;
+	const IOBUS_SLOT *s = NULL;
+	if (h->slots == NULL)
+	{
+		slot->addr = addr;
+		return iobus_ioctl(h, IOBUS_IOC_SCAN_READ, slot);
+	}
+	/* 按iobus_ioctl.h中IOBUS_SLOT的说明无锁读取 */
+	s = &h->slots[addr];
+	do {
+		seq = IOBUS_ACCESS(s->seq);
+		iobus_mb();
+		memcpy(slot, (const void *)s, sizeof(*slot));
+		iobus_mb();
+	} while ((seq & 1) || IOBUS_ACCESS(s->seq) != seq);
+	return 0;
+}
+
+int iobus_bcast_set(IOBUS_HANDLE *h, const IOBUS_BCAST_ENTRY *entries, unsigned int count)
+{
+	IOBUS_BCAST_CFG cfg;
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.entries = (unsigned long)entries;
+	cfg.count = count;
+	return iobus_ioctl(h, IOBUS_IOC_BCAST_SET, &cfg);
+}
+
+__u64 iobus_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,104 @@
+/**
+  * @brief  iobus用户态库，封装/dev/iobusN的事务、FRAMED批量读写、mmap收发队列、扫描结果表和周期广播接口
+  *         除特别说明外，函数成功返回0或非负值，失败返回-errno
+  *         一个IOBUS_HANDLE只应由一个线程使用，mmap收发队列为单生产者/单消费者
+  *         注意：收发队列共享区映射期间驱动拒绝read/write(-EBUSY)，扫描结果表的映射不受此限制
+  */
+#ifndef _LIBIOBUS_H_
+#define _LIBIOBUS_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "iobus_ioctl.h"
+
+#define IOBUS_DEV_PATH			"/dev/iobus%d"
+
+typedef struct {
+	int fd;
+	int mode;					//当前读写格式 IOBUS_MODE_*
+	/* iobus_shm_map映射的收发队列共享区 */
+	void *shm;
+	size_t shm_size;
+	IOBUS_SHM_HDR *hdr;
+	unsigned char *rx_frames;	//帧数组，按hdr->rx.stride/hdr->tx.stride访问
+	unsigned char *tx_frames;
+	unsigned int frame_max;		//帧data可用的字节数，iobus_tx_slot取得的帧len不能超过该值
+	/* iobus_slots_map映射的扫描结果表 */
+	const IOBUS_SLOT *slots;
+}IOBUS_HANDLE;
+
+/* FRAMED格式的批量写缓存，帧头和数据直接排在用户提供的缓存中 */
+typedef struct {
+	unsigned char *buf;
+	size_t size;
+	size_t len;					//已填入的字节数
+	unsigned int count;			//已填入的帧数
+}IOBUS_BATCH;
+
+/* 打开/关闭，index为控制器序号，flags为open的附加标志，如O_NONBLOCK */
+int iobus_open(IOBUS_HANDLE *h, int index, int flags);
+void iobus_close(IOBUS_HANDLE *h);
+
+/* 设备设置 */
+int iobus_set_mode(IOBUS_HANDLE *h, int mode);
+int iobus_set_chan(IOBUS_HANDLE *h, int chan);
+int iobus_set_run_stat(IOBUS_HANDLE *h, int stat);
+int iobus_set_led(IOBUS_HANDLE *h, int led);
+int iobus_set_busy_poll(IOBUS_HANDLE *h, unsigned int us);
+int iobus_set_rx_errors(IOBUS_HANDLE *h, int enable);
+int iobus_set_redundant(IOBUS_HANDLE *h, int enable, int primary, int backup);
+int iobus_stats_reset(IOBUS_HANDLE *h);
+
+/* 一次持锁批量读写CPLD寄存器，读操作的value被回写 */
+int iobus_reg_batch(IOBUS_HANDLE *h, IOBUS_REG_OP *ops, unsigned int count);
+
+/* 事务：发送一帧并等待卡件返回，返回返回帧长度，超时返回-ETIMEDOUT；tstamp可为NULL */
+int iobus_transact(IOBUS_HANDLE *h, IOBUS_XACT *xact);
+int iobus_request(IOBUS_HANDLE *h, unsigned char addr, unsigned char chan, const void *tx, size_t tx_len,
+				  void *rx, size_t rx_size, unsigned int timeout_us, __u64 *tstamp);
+
+/* FRAMED批量写：先iobus_batch_add填入多帧，再一次iobus_batch_send写出
+ * iobus_batch_send返回驱动接受的帧数，未被接受的帧(非阻塞时发送队列满)留在缓存中
+ */
+void iobus_batch_init(IOBUS_BATCH *b, void *buf, size_t size);
+int iobus_batch_add(IOBUS_BATCH *b, unsigned char addr, unsigned char chan, unsigned short flags, const void *data, size_t len);
+int iobus_batch_send(IOBUS_HANDLE *h, IOBUS_BATCH *b);
+
+/* FRAMED批量读：iobus_recv读取尽可能多的帧，再用iobus_rx_next逐帧遍历，off从0开始，遍历完返回NULL
+ * 帧数据紧跟帧头，len为0的帧头是出错帧的描述符(见iobus_set_rx_errors)
+ */
+ssize_t iobus_recv(IOBUS_HANDLE *h, void *buf, size_t size);
+const IOBUS_RX_HDR *iobus_rx_next(const void *buf, size_t len, size_t *off);
+
+/* mmap收发队列，无系统调用地收发帧
+ * iobus_rx_peek取得最早的接收帧，用完后iobus_rx_release；队列空时返回NULL
+ * iobus_tx_slot取得空闲发送帧，填好len/addr/chan/flags/data后iobus_tx_commit；队列满时返回NULL
+ * 队列中的帧只有frame_max字节data可用，不能把返回的指针当作IOBUS_FRAME数组使用
+ * iobus_tx_commit只在驱动已停止取帧时发一次IOBUS_IOC_TX_KICK
+ */
+int iobus_shm_map(IOBUS_HANDLE *h);
+void iobus_shm_unmap(IOBUS_HANDLE *h);
+IOBUS_FRAME *iobus_rx_peek(IOBUS_HANDLE *h);
+void iobus_rx_release(IOBUS_HANDLE *h);
+IOBUS_FRAME *iobus_tx_slot(IOBUS_HANDLE *h);
+int iobus_tx_commit(IOBUS_HANDLE *h);
+/* 最近一次发送完成的帧数计数和时间 */
+void iobus_tx_done(IOBUS_HANDLE *h, __u32 *count, __u64 *tstamp);
+
+/* 周期扫描与扫描结果表
+ * iobus_slot_read在已映射结果表时无锁读取一致的快照，否则用IOBUS_IOC_SCAN_READ
+ */
+int iobus_scan_set(IOBUS_HANDLE *h, const IOBUS_SCAN_ENTRY *entries, unsigned int count, unsigned int period_us);
+int iobus_scan_start(IOBUS_HANDLE *h);
+int iobus_scan_stop(IOBUS_HANDLE *h);
+int iobus_slots_map(IOBUS_HANDLE *h);
+void iobus_slots_unmap(IOBUS_HANDLE *h);
+int iobus_slot_read(IOBUS_HANDLE *h, unsigned char addr, IOBUS_SLOT *slot);
+
+/* 周期广播，count为0时停止全部广播 */
+int iobus_bcast_set(IOBUS_HANDLE *h, const IOBUS_BCAST_ENTRY *entries, unsigned int count);
+
+/* CLOCK_MONOTONIC当前时间，单位ns，与驱动给出的时间戳可直接比较 */
+__u64 iobus_now_ns(void);
+
+#endif /* _LIBIOBUS_H_ */